@@ -13,11 +13,16 @@ namespace Antmicro.Renode.Plugins.VerilatorPlugin.Connection
     public interface IVerilatorConnection : IDisposable, IHasOwnLife
     {
         bool TrySendMessage(ProtocolMessage message);
+        // The payload is received by the agent while handling the message
+        bool TrySendMessage(ProtocolMessage message, ProtocolMessage[] payload);
         bool TryRespond(ProtocolMessage message);
         bool TryReceiveMessage(out ProtocolMessage message);
         void HandleMessage();
 
         void Abort();
         string SimulationFilePath { set; }
+        // Offered to the verilated peripheral during the handshake, so it has to be set before SimulationFilePath
+        ProtocolExtensions OfferedExtensions { get; set; }
+        ProtocolExtensions Extensions { get; }
     }
 }
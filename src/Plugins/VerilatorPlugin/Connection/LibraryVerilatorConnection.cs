@@ -5,6 +5,7 @@
 //  Full license text is available in 'licenses/MIT.txt'.
 //
 using System;
+using System.Collections.Generic;
 using System.Threading;
 using System.Runtime.InteropServices;
 using System.Collections.Concurrent;
@@ -23,29 +24,37 @@ public LibraryVerilatorConnection(IEmulationElement parentElement, int timeout,
             this.parentElement = parentElement;
             this.timeout = timeout;
             receivedHandler = receiveAction;
-            mainReceived = new AutoResetEvent(initialState: false);
+            mainReceived = new SemaphoreSlim(initialCount: 0);
+            mainQueue = new ConcurrentQueue<ProtocolMessage>();
             receiveQueue = new BlockingCollection<ProtocolMessage>();
             senderData = new BlockingCollection<string>();
             peripheralActive = new CancellationTokenSource();
-            nativeLock = new object();
         }
 
         public void Dispose()
         {
             peripheralActive.Cancel();
-            binder?.Dispose();
-            Marshal.FreeHGlobal(mainResponsePointer);
-            Marshal.FreeHGlobal(senderResponsePointer);
+            library?.Detach(this, requestPointer);
+            Marshal.FreeHGlobal(requestPointer);
         }
 
         public bool TrySendMessage(ProtocolMessage message)
         {
-            lock(nativeLock)
+            library.HandleRequest(this, message, requestPointer);
+            return true;
+        }
+
+        public bool TrySendMessage(ProtocolMessage message, ProtocolMessage[] payload)
+        {
+            // The agent receives the payload while handling the message, so it has to be queued first
+            foreach(var payloadMessage in payload)
             {
-                Marshal.StructureToPtr(message, mainResponsePointer, true);
-                handleRequest(mainResponsePointer);
+                if(!TryRespond(payloadMessage))
+                {
+                    return false;
+                }
             }
-            return true;
+            return TrySendMessage(message);
         }
 
         public bool TryRespond(ProtocolMessage message)
@@ -64,11 +73,11 @@ public bool TryRespond(ProtocolMessage message)
 
         public bool TryReceiveMessage(out ProtocolMessage message)
         {
-            if(mainReceived.WaitOne(timeout))
+            // The response is usually set synchronously by handleRequest, so the wait doesn't block
+            if(mainReceived.Wait(timeout))
             {
-                DebugHelper.Assert(receivedMessage.HasValue);
-                message = receivedMessage.Value;
-                receivedMessage = null;
+                var dequeued = mainQueue.TryDequeue(out message);
+                DebugHelper.Assert(dequeued);
                 return true;
             }
 
@@ -101,22 +110,19 @@ public void Resume()
             // intentionally left empty
         }
 
-        [Export]
         public void HandleMainMessage(IntPtr received)
         {
             // Main is used when Renode initiates communication.
-            DebugHelper.Assert(!receivedMessage.HasValue);
-            receivedMessage = (ProtocolMessage)Marshal.PtrToStructure(received, typeof(ProtocolMessage));
-            mainReceived.Set();
+            mainQueue.Enqueue(ProtocolMessage.Read(received));
+            mainReceived.Release();
         }
 
-        [Export]
         public void HandleSenderMessage(IntPtr received)
         {
             // Sender is used when peripheral initiates communication.
             try
             {
-                var message = (ProtocolMessage)Marshal.PtrToStructure(received, typeof(ProtocolMessage));
+                var message = ProtocolMessage.Read(received);
                 if(message.ActionId == ActionType.LogMessage && (int)message.Address > 0)
                 {
                     // ProtocolMessage doesn't allow for larger then 8 bytes data transfer, so LogMessage is
@@ -134,13 +140,12 @@ public void HandleSenderMessage(IntPtr received)
             }
         }
 
-        [Export]
         public void Receive(IntPtr messagePtr)
         {
             try
             {
                 var message = receiveQueue.Take(peripheralActive.Token);
-                Marshal.StructureToPtr(message, messagePtr, false);
+                message.Write(messagePtr);
             }
             catch(OperationCanceledException)
             {
@@ -160,27 +165,28 @@ public string SimulationFilePath
                 {
                     throw new ArgumentException($"Cannot find library {value}");
                 }
-                lock(nativeLock)
+                try
                 {
-                    try
-                    {
-                        simulationFilePath = value;
-                        binder = new NativeBinder(this, value);
-                        initializeNative();
-                        mainResponsePointer = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(ProtocolMessage)));
-                        senderResponsePointer = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(ProtocolMessage)));
-                        resetPeripheral();
-                    }
-                    catch(Exception e)
-                    {
-                        var info = "Error starting verilated peripheral!\n" + e.Message;
-                        parentElement.Log(LogLevel.Error, info);
-                        throw new RecoverableException(info);
-                    }
+                    simulationFilePath = value;
+                    // Requests are written in place to a single preallocated slot, which is reused for every message
+                    requestPointer = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(ProtocolMessage)));
+                    library = NativeLibrary.Attach(value, this);
+                    library.ResetPeripheral(this);
+                }
+                catch(Exception e)
+                {
+                    var info = "Error starting verilated peripheral!\n" + e.Message;
+                    parentElement.Log(LogLevel.Error, info);
+                    throw new RecoverableException(info);
                 }
             }
         }
 
+        // There's no handshake with the library, no extensions are used
+        public ProtocolExtensions OfferedExtensions { get; set; }
+
+        public ProtocolExtensions Extensions => ProtocolExtensions.None;
+
         private void HandleReceived(ProtocolMessage message)
         {
             switch(message.ActionId)
@@ -203,27 +209,177 @@ private void HandleReceived(ProtocolMessage message)
         }
 
         private string simulationFilePath;
-        private NativeBinder binder;
-        private IntPtr mainResponsePointer;
-        private IntPtr senderResponsePointer;
-        private ProtocolMessage? receivedMessage;
+        private NativeLibrary library;
+        private int instance;
+        private IntPtr requestPointer;
         private IEmulationElement parentElement;
         private Action<ProtocolMessage> receivedHandler;
 
-        private readonly AutoResetEvent mainReceived;
+        private readonly SemaphoreSlim mainReceived;
+        private readonly ConcurrentQueue<ProtocolMessage> mainQueue;
         private readonly CancellationTokenSource peripheralActive;
         private readonly BlockingCollection<ProtocolMessage> receiveQueue;
         private readonly BlockingCollection<string> senderData;
         private readonly int timeout;
-        private readonly object nativeLock;
+
+        // A library is loaded only once, so all verilated peripherals using it share the native
+        // bindings. Every peripheral gets its own agent in the library, numbered by the library,
+        // and the one handling the requests (and so issuing the callbacks) is selected with SelectInstance.
+        private class NativeLibrary
+        {
+            public static NativeLibrary Attach(string path, LibraryVerilatorConnection connection)
+            {
+                lock(libraries)
+                {
+                    if(!libraries.TryGetValue(path, out var library))
+                    {
+                        library = new NativeLibrary(path);
+                        libraries.Add(path, library);
+                    }
+                    library.Add(connection);
+                    return library;
+                }
+            }
+
+            public void Detach(LibraryVerilatorConnection connection, IntPtr requestPointer)
+            {
+                lock(libraries)
+                {
+                    lock(nativeLock)
+                    {
+                        // The library removes the agent on disconnect, its number can be given to a new one
+                        HandleRequest(connection, new ProtocolMessage(ActionType.Disconnect, 0, 0), requestPointer);
+                        instances.Remove(connection.instance);
+                        if(instances.Count == 0)
+                        {
+                            libraries.Remove(path);
+                            binder.Dispose();
+                            Marshal.FreeHGlobal(selectPointer);
+                        }
+                    }
+                }
+            }
+
+            public void HandleRequest(LibraryVerilatorConnection connection, ProtocolMessage message, IntPtr requestPointer)
+            {
+                lock(nativeLock)
+                {
+                    // Requests may be nested, e.g. when the agent writes to another peripheral using this library
+                    var previous = current;
+                    Select(connection.instance);
+                    try
+                    {
+                        message.Write(requestPointer);
+                        handleRequest(requestPointer);
+                    }
+                    finally
+                    {
+                        Select(previous);
+                    }
+                }
+            }
+
+            public void ResetPeripheral(LibraryVerilatorConnection connection)
+            {
+                lock(nativeLock)
+                {
+                    var previous = current;
+                    Select(connection.instance);
+                    try
+                    {
+                        resetPeripheral();
+                    }
+                    finally
+                    {
+                        Select(previous);
+                    }
+                }
+            }
+
+            [Export]
+            public void HandleMainMessage(IntPtr received)
+            {
+                Current.HandleMainMessage(received);
+            }
+
+            [Export]
+            public void HandleSenderMessage(IntPtr received)
+            {
+                Current.HandleSenderMessage(received);
+            }
+
+            [Export]
+            public void Receive(IntPtr messagePtr)
+            {
+                Current.Receive(messagePtr);
+            }
+
+            private NativeLibrary(string path)
+            {
+                this.path = path;
+                instances = new Dictionary<int, LibraryVerilatorConnection>();
+                nativeLock = new object();
+                selectPointer = Marshal.AllocHGlobal(Marshal.SizeOf(typeof(ProtocolMessage)));
+                binder = new NativeBinder(this, path);
+            }
+
+            private void Add(LibraryVerilatorConnection connection)
+            {
+                lock(nativeLock)
+                {
+                    // initializeNative creates a new agent, selects it and responds with its instance number
+                    registering = connection;
+                    try
+                    {
+                        initializeNative();
+                    }
+                    finally
+                    {
+                        registering = null;
+                    }
+                    if(!connection.TryReceiveMessage(out var registered) || registered.ActionId != ActionType.SelectInstance)
+                    {
+                        throw new RecoverableException("The verilated library didn't respond with the instance number");
+                    }
+                    connection.instance = (int)registered.Data;
+                    instances[connection.instance] = connection;
+                    current = connection.instance;
+                }
+            }
+
+            private void Select(int instance)
+            {
+                if(instance == current)
+                {
+                    return;
+                }
+                new ProtocolMessage(ActionType.SelectInstance, 0, (ulong)instance).Write(selectPointer);
+                handleRequest(selectPointer);
+                current = instance;
+            }
+
+            // Receives the callbacks of the agent being created, before its number is known
+            private LibraryVerilatorConnection Current => registering ?? instances[current];
+
+            private int current;
+            private LibraryVerilatorConnection registering;
+
+            private readonly string path;
+            private readonly Dictionary<int, LibraryVerilatorConnection> instances;
+            private readonly object nativeLock;
+            private readonly IntPtr selectPointer;
+            private readonly NativeBinder binder;
+
+            private static readonly Dictionary<string, NativeLibrary> libraries = new Dictionary<string, NativeLibrary>();
 
 #pragma warning disable 649
-        [Import(UseExceptionWrapper = false)]
-        private ActionIntPtr handleRequest;
-        [Import(UseExceptionWrapper = false)]
-        private Action initializeNative;
-        [Import(UseExceptionWrapper = false)]
-        public Action resetPeripheral;
+            [Import(UseExceptionWrapper = false)]
+            private ActionIntPtr handleRequest;
+            [Import(UseExceptionWrapper = false)]
+            private Action initializeNative;
+            [Import(UseExceptionWrapper = false)]
+            private Action resetPeripheral;
 #pragma warning restore 649
+        }
     }
 }
@@ -39,6 +39,22 @@ public enum ActionType
         WriteToBusWord,
         WriteToBusDoubleWord,
         WriteToBusQuadWord,
+        Batch,
+        WriteToBusBlock,
+        ReadFromBusBlock,
+        BlockData,
+        GetBlock,
+        PushBlock,
+        RegisterCacheableRegion,
+        InvalidateCachedRange,
+        RegisterSharedMemory,
+        PushDoubleWordMasked,
+        SelectInstance,
+        EnableStatistics,
+        GetStatistics,
+        CycleOffset,
+        SaveState,
+        LoadState,
         Step = 100, //all custom action type numbers must not fall in this range
     }
 }
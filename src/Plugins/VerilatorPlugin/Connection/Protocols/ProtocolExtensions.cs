@@ -0,0 +1,29 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+//  This file is licensed under the MIT License.
+//  Full license text is available in 'licenses/MIT.txt'.
+//
+using System;
+
+namespace Antmicro.Renode.Plugins.VerilatorPlugin.Connection.Protocols
+{
+    // ProtocolExtensions must be in sync with the Verilator integration library.
+    // Renode sends the extensions it supports in the Handshake message
+    // and the verilated peripheral responds with the ones it's going to use.
+    [Flags]
+    public enum ProtocolExtensions : ulong
+    {
+        None = 0,
+        BatchedFrames = 1 << 0,
+        // Write requests aren't acknowledged, failures are reported with Error messages on the sender channel
+        PostedWrites = 1 << 1,
+        // Messages sent by the verilated peripheral on its own (pushes, memory requests, interrupts)
+        // are timestamped with CycleOffset messages carrying the number of cycles since the start
+        // of the quantum, which apply until the next CycleOffset or the end of the quantum
+        CycleOffsets = 1 << 2,
+        // The response to TickClock carries in Address the activity of the verilated peripheral in the quantum:
+        // bus accesses requested by Renode and messages it sent on its own, e.g. pushes and interrupts
+        ActivityReports = 1 << 3,
+    }
+}
@@ -4,6 +4,7 @@
 //  This file is licensed under the MIT License.
 //  Full license text is available in 'licenses/MIT.txt'.
 //
+using System;
 using System.Runtime.InteropServices;
 
 namespace Antmicro.Renode.Plugins.VerilatorPlugin.Connection.Protocols
@@ -58,8 +59,61 @@ public void Deserialize(byte[] message)
             }
         }
 
+        // Reads the message in place, without the overhead of Marshal.PtrToStructure
+        public static ProtocolMessage Read(IntPtr pointer)
+        {
+            return new ProtocolMessage(
+                (ActionType)Marshal.ReadInt32(pointer, ActionIdOffset),
+                (ulong)Marshal.ReadInt64(pointer, AddressOffset),
+                (ulong)Marshal.ReadInt64(pointer, DataOffset));
+        }
+
+        // Writes the message in place, without the overhead of Marshal.StructureToPtr
+        public void Write(IntPtr pointer)
+        {
+            Marshal.WriteInt32(pointer, ActionIdOffset, (int)ActionId);
+            Marshal.WriteInt64(pointer, AddressOffset, (long)Address);
+            Marshal.WriteInt64(pointer, DataOffset, (long)Data);
+        }
+
+        // Splits the data of a block transfer into BlockData messages
+        public static ProtocolMessage[] PackBlock(byte[] data, int startingIndex, int count)
+        {
+            var result = new ProtocolMessage[(count + BlockDataSize - 1) / BlockDataSize];
+            var record = new byte[BlockDataSize];
+            for(var i = 0; i < result.Length; i++)
+            {
+                var offset = i * BlockDataSize;
+                var size = Math.Min(BlockDataSize, count - offset);
+                Array.Clear(record, 0, BlockDataSize);
+                Array.Copy(data, startingIndex + offset, record, 0, size);
+                result[i] = new ProtocolMessage(ActionType.BlockData, BitConverter.ToUInt64(record, 0), BitConverter.ToUInt64(record, 8));
+            }
+            return result;
+        }
+
+        // Copies the data carried by a BlockData message to `data` at `offset`
+        public void UnpackBlock(byte[] data, int offset)
+        {
+            var size = Math.Min(BlockDataSize, data.Length - offset);
+            var record = new byte[BlockDataSize];
+            Array.Copy(BitConverter.GetBytes(Address), 0, record, 0, 8);
+            Array.Copy(BitConverter.GetBytes(Data), 0, record, 8, 8);
+            Array.Copy(record, 0, data, offset, size);
+        }
+
         public ActionType ActionId { get; set; }
         public ulong Address { get; set; }
         public ulong Data { get; set; }
+
+        // Number of bytes carried by a single BlockData message
+        public const int BlockDataSize = 16;
+        // PushDoubleWordMasked carries the mask of bytes to write above the double word
+        public const int PushMaskShift = 32;
+
+        // Offsets of the fields in the packed native structure
+        private const int ActionIdOffset = 0;
+        private const int AddressOffset = 4;
+        private const int DataOffset = 12;
     }
 }
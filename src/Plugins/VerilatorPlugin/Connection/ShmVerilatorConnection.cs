@@ -0,0 +1,664 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+//  This file is licensed under the MIT License.
+//  Full license text is available in 'licenses/MIT.txt'.
+//
+using System;
+using System.Diagnostics;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Runtime.InteropServices;
+using System.Text;
+using System.Threading;
+using Antmicro.Renode.Core;
+using Antmicro.Renode.Exceptions;
+using Antmicro.Renode.Logging;
+using Antmicro.Renode.Peripherals;
+using Antmicro.Renode.Peripherals.CPU;
+using Antmicro.Renode.Plugins.VerilatorPlugin.Connection.Protocols;
+#if !PLATFORM_WINDOWS
+using Mono.Unix.Native;
+#endif
+
+namespace Antmicro.Renode.Plugins.VerilatorPlugin.Connection
+{
+    // Connection to a verilated peripheral running on the same host through a POSIX shared-memory
+    // segment, served by ShmCommunicationChannel of the Verilator integration library.
+    // Renode creates the segment and starts the peripheral with `shm <segment name>` arguments.
+    // The segment holds three single-producer single-consumer byte rings (requests, responses
+    // and sender), which carry the same stream of messages as the sockets.
+    public class ShmVerilatorConnection : IVerilatorConnection, IDisposable
+    {
+        public ShmVerilatorConnection(IPeripheral parentElement, int timeoutInMilliseconds, Action<ProtocolMessage> receiveAction)
+        {
+            this.parentElement = parentElement;
+            timeout = timeoutInMilliseconds;
+            receivedHandler = receiveAction;
+            segmentName = $"/renode-verilator-{Process.GetCurrentProcess().Id}-{Interlocked.Increment(ref segmentCounter)}";
+
+            pauseMRES = new ManualResetEventSlim(initialState: true);
+            receiveThread = new Thread(ReceiveLoop)
+            {
+                IsBackground = true,
+                Name = "Verilated.Receiver"
+            };
+        }
+
+        public void Dispose()
+        {
+            disposeInitiated = true;
+
+            if(verilatedProcess != null)
+            {
+                // Ask verilatedProcess to close, kill if it doesn't
+                if(!verilatedProcess.HasExited)
+                {
+                    parentElement.DebugLog($"Verilated peripheral '{simulationFilePath}' is still working...");
+                    var exited = false;
+
+                    if(segment != null)
+                    {
+                        parentElement.DebugLog("Trying to close it gracefully by sending 'Disconnect' message...");
+                        TrySendMessage(new ProtocolMessage(ActionType.Disconnect, 0, 0));
+                        exited = verilatedProcess.WaitForExit(500);
+                    }
+
+                    if(exited)
+                    {
+                        parentElement.DebugLog("Verilated peripheral exited gracefully.");
+                    }
+                    else
+                    {
+                        KillVerilatedProcess();
+                        parentElement.Log(LogLevel.Warning, "Verilated peripheral had to be killed.");
+                    }
+                }
+                verilatedProcess.Dispose();
+            }
+
+            // The receiver mustn't access the segment after it's unmapped
+            segment?.Close();
+            pauseMRES.Set();
+            if(receiveThread.IsAlive)
+            {
+                receiveThread.Join();
+            }
+            pauseMRES.Dispose();
+            segment?.Dispose();
+            RemoveSegmentFile();
+        }
+
+        public bool TrySendMessage(ProtocolMessage message)
+        {
+            var serializedMessage = message.Serialize();
+            return requests.TryWrite(serializedMessage, serializedMessage.Length, timeout);
+        }
+
+        public bool TrySendMessage(ProtocolMessage message, ProtocolMessage[] payload)
+        {
+            // Messages are written in one go, so the agent is woken up once
+            var messageSize = Marshal.SizeOf(message);
+            var serializedMessages = new byte[messageSize * (payload.Length + 1)];
+            Array.Copy(message.Serialize(), serializedMessages, messageSize);
+            for(var i = 0; i < payload.Length; i++)
+            {
+                Array.Copy(payload[i].Serialize(), 0, serializedMessages, messageSize * (i + 1), messageSize);
+            }
+            return requests.TryWrite(serializedMessages, serializedMessages.Length, timeout);
+        }
+
+        public bool TryRespond(ProtocolMessage message)
+        {
+            return TrySendMessage(message);
+        }
+
+        public bool TryReceiveMessage(out ProtocolMessage message)
+        {
+            return responses.TryReceiveMessage(out message);
+        }
+
+        public void HandleMessage()
+        {
+        }
+
+        public void Abort()
+        {
+            abort = true;
+            segment?.Close();
+            KillVerilatedProcess();
+        }
+
+        public void Start()
+        {
+            receiveThread.Start();
+        }
+
+        public void Pause()
+        {
+            pauseMRES.Reset();
+        }
+
+        public void Resume()
+        {
+            pauseMRES.Set();
+        }
+
+        public string SimulationFilePath
+        {
+            set
+            {
+                if(!IsSupported)
+                {
+                    LogAndThrowRE("Shared memory connection to the verilated peripheral is only supported on Linux!");
+                }
+                simulationFilePath = value;
+                parentElement.Log(LogLevel.Debug,
+                    "Trying to run and connect to the verilated peripheral '{0}' through shared memory segment '{1}'...",
+                    value, segmentName);
+                try
+                {
+                    segment = new Segment(SegmentFilePath, RingSize);
+                }
+                catch(Exception e)
+                {
+                    LogAndThrowRE($"Unable to create shared memory segment '{segmentName}': {e.Message}");
+                }
+                requests = new RingComunicator(parentElement, segment.Requests, timeout, IsPeerAlive);
+                responses = new RingComunicator(parentElement, segment.Responses, timeout, IsPeerAlive);
+                sender = new RingComunicator(parentElement, segment.Sender, Timeout.Infinite, IsPeerAlive);
+
+#if !PLATFORM_WINDOWS
+                Mono.Unix.Native.Syscall.chmod(value, FilePermissions.S_IRWXU); //setting permissions to 0x700
+#endif
+                InitVerilatedProcess(value);
+
+                var connected = TryHandshake();
+                // The peripheral has the segment mapped once it responds, so it's no longer needed in the file system
+                RemoveSegmentFile();
+                if(!connected)
+                {
+                    KillVerilatedProcess();
+                    LogAndThrowRE($"Connection to the verilated peripheral ({value}) failed!");
+                }
+                parentElement.Log(LogLevel.Debug, "Connected to the verilated peripheral!");
+            }
+        }
+
+        public ProtocolExtensions OfferedExtensions { get; set; } = DefaultExtensions;
+
+        public ProtocolExtensions Extensions { get; private set; }
+
+        private void ReceiveLoop()
+        {
+            while(!disposeInitiated)
+            {
+                if(sender.TryReceiveMessage(out var message) && !disposeInitiated)
+                {
+                    pauseMRES.Wait();
+                    if(!disposeInitiated)
+                    {
+                        HandleReceived(message);
+                    }
+                }
+                else if(disposeInitiated || abort || segment.Closed)
+                {
+                    break;
+                }
+                else
+                {
+                    AbortAndLogError("Connection error!");
+                }
+
+                // Pause in ReceiveLoop() has to be handled manually
+                pauseMRES?.Wait();
+            }
+        }
+
+        private void InitVerilatedProcess(string filePath)
+        {
+            try
+            {
+                verilatedProcess = new Process
+                {
+                    StartInfo = new ProcessStartInfo(filePath)
+                    {
+                        UseShellExecute = false,
+                        Arguments = $"shm {segmentName}"
+                    }
+                };
+
+                verilatedProcess.Start();
+            }
+            catch(Exception e)
+            {
+                verilatedProcess = null;
+                RemoveSegmentFile();
+                LogAndThrowRE($"Error starting verilated peripheral!\n{e.Message}");
+            }
+        }
+
+        private bool IsPeerAlive()
+        {
+            return !disposeInitiated && !abort && !segment.Closed && verilatedProcess != null && !verilatedProcess.HasExited;
+        }
+
+        private void RemoveSegmentFile()
+        {
+            try
+            {
+                File.Delete(SegmentFilePath);
+            }
+            catch(IOException)
+            {
+                // The peripheral works without the file, the segment is only leaked until reboot
+                parentElement.Log(LogLevel.Warning, "Unable to remove shared memory segment '{0}'", segmentName);
+            }
+        }
+
+        private void LogAndThrowRE(string info)
+        {
+            parentElement.Log(LogLevel.Error, info);
+            throw new RecoverableException(info);
+        }
+
+        private void AbortAndLogError(string message)
+        {
+            if(disposeInitiated)
+            {
+                return;
+            }
+            parentElement.Log(LogLevel.Error, message);
+            Abort();
+
+            // Due to deadlock, we need to abort CPU instead of pausing emulation.
+            throw new CpuAbortException();
+        }
+
+        private void KillVerilatedProcess()
+        {
+            try
+            {
+                verilatedProcess?.Kill();
+            }
+            catch
+            {
+                return;
+            }
+        }
+
+        private bool TryHandshake()
+        {
+            if(!TrySendMessage(new ProtocolMessage(ActionType.Handshake, 0, (ulong)OfferedExtensions))
+               || !TryReceiveMessage(out var result)
+               || result.ActionId != ActionType.Handshake)
+            {
+                return false;
+            }
+
+            Extensions = (ProtocolExtensions)result.Data & OfferedExtensions;
+            parentElement.Log(LogLevel.Debug, "Negotiated protocol extensions: {0}", Extensions);
+            return true;
+        }
+
+        private void HandleReceived(ProtocolMessage message)
+        {
+            switch(message.ActionId)
+            {
+                case ActionType.LogMessage:
+                    // message.Address is used to transfer log length
+                    if(sender.TryReceiveString(out var log, (int)message.Address))
+                    {
+                        parentElement.Log((LogLevel)(int)message.Data, $"Verilated peripheral: {log}");
+                    }
+                    else
+                    {
+                        parentElement.Log(LogLevel.Warning, "Failed to receive log message!");
+                    }
+                    break;
+                default:
+                    receivedHandler(message);
+                    break;
+            }
+        }
+
+        private string SegmentFilePath => SegmentDirectory + segmentName;
+
+        private bool abort;
+        private volatile bool disposeInitiated;
+        private string simulationFilePath;
+        private Process verilatedProcess;
+        private Segment segment;
+        private RingComunicator requests;
+        private RingComunicator responses;
+        private RingComunicator sender;
+        private Action<ProtocolMessage> receivedHandler;
+
+        private readonly IEmulationElement parentElement;
+        private readonly int timeout;
+        private readonly string segmentName;
+        private readonly Thread receiveThread;
+        private readonly ManualResetEventSlim pauseMRES;
+
+        private static int segmentCounter;
+
+#if PLATFORM_LINUX
+        private static readonly bool IsSupported = true;
+#else
+        private static readonly bool IsSupported = false;
+#endif
+
+        private const string SegmentDirectory = "/dev/shm";
+        private const int RingSize = 1 << 20;
+        // Posted writes change the error handling of the peripheral and cycle offsets cost a message
+        // per timestamped event, so they're only offered if the peripheral asks for them
+        private const ProtocolExtensions DefaultExtensions = ProtocolExtensions.BatchedFrames | ProtocolExtensions.ActivityReports;
+
+        // Reads and writes messages as SocketComunicator does, including the batch frames
+        private class RingComunicator
+        {
+            public RingComunicator(IEmulationElement logger, Ring ring, int timeoutInMilliseconds, Func<bool> isPeerAlive)
+            {
+                this.logger = logger;
+                this.ring = ring;
+                this.isPeerAlive = isPeerAlive;
+                timeout = timeoutInMilliseconds;
+            }
+
+            public bool TryWrite(byte[] data, int count, int timeoutInMilliseconds)
+            {
+                return ring.TryTransfer(data, count, true, timeoutInMilliseconds, isPeerAlive);
+            }
+
+            public bool TryReceiveMessage(out ProtocolMessage message)
+            {
+                message = default(ProtocolMessage);
+
+                var result = TryReceive(out var buffer, Marshal.SizeOf(message));
+                if(result)
+                {
+                    message.Deserialize(buffer);
+                    if(message.ActionId == ActionType.Batch)
+                    {
+                        // Batch frame carries multiple messages, following receives are served from it
+                        // message.Address is the number of messages, message.Data is the frame size
+                        if(!TryReceiveFromRing(out frame, (int)message.Data))
+                        {
+                            return false;
+                        }
+                        frameOffset = 0;
+                        return TryReceiveMessage(out message);
+                    }
+                }
+                return result;
+            }
+
+            public bool TryReceiveString(out string message, int size)
+            {
+                message = String.Empty;
+                var result = TryReceive(out var buffer, size);
+                if(result)
+                {
+                    message = Encoding.ASCII.GetString(buffer);
+                }
+                return result;
+            }
+
+            private bool TryReceive(out byte[] buffer, int size)
+            {
+                if(frame == null)
+                {
+                    return TryReceiveFromRing(out buffer, size);
+                }
+
+                buffer = null;
+                if(frameOffset + size > frame.Length)
+                {
+                    logger.DebugLog("Malformed batch frame!");
+                    frame = null;
+                    return false;
+                }
+
+                buffer = new byte[size];
+                Array.Copy(frame, frameOffset, buffer, 0, size);
+                frameOffset += size;
+                if(frameOffset == frame.Length)
+                {
+                    frame = null;
+                }
+                return true;
+            }
+
+            private bool TryReceiveFromRing(out byte[] buffer, int size)
+            {
+                buffer = new byte[size];
+                return ring.TryTransfer(buffer, size, false, timeout, isPeerAlive);
+            }
+
+            private byte[] frame;
+            private int frameOffset;
+
+            private readonly IEmulationElement logger;
+            private readonly Ring ring;
+            private readonly Func<bool> isPeerAlive;
+            private readonly int timeout;
+        }
+
+        // Layout of the segment, must be in sync with ShmSegmentHeader of the Verilator integration library:
+        // the header (magic, version, closed flag) with three ShmRing structures, followed by the ring buffers
+        private unsafe class Segment : IDisposable
+        {
+            public Segment(string path, int ringSize)
+            {
+                var size = RingsOffset + 3 * ringSize;
+                using(var file = new FileStream(path, FileMode.CreateNew, FileAccess.ReadWrite))
+                {
+                    file.SetLength(size);
+                    mapping = MemoryMappedFile.CreateFromFile(file, null, size, MemoryMappedFileAccess.ReadWrite, HandleInheritability.None, leaveOpen: false);
+                }
+                view = mapping.CreateViewAccessor(0, size);
+                view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+
+                Requests = new Ring(pointer, RequestsOffset, RingsOffset, ringSize);
+                Responses = new Ring(pointer, ResponsesOffset, RingsOffset + ringSize, ringSize);
+                Sender = new Ring(pointer, SenderOffset, RingsOffset + 2 * ringSize, ringSize);
+                *(uint*)(pointer + VersionOffset) = Version;
+                // The magic is written last, the peripheral can't map the segment before it's started anyway
+                Volatile.Write(ref *(uint*)(pointer + MagicOffset), Magic);
+            }
+
+            public void Dispose()
+            {
+                if(pointer == null)
+                {
+                    return;
+                }
+                Close();
+                pointer = null;
+                view.SafeMemoryMappedViewHandle.ReleasePointer();
+                view.Dispose();
+                mapping.Dispose();
+            }
+
+            // Makes the peripheral stop waiting on the rings
+            public void Close()
+            {
+                if(pointer == null)
+                {
+                    return;
+                }
+                Volatile.Write(ref *(int*)(pointer + ClosedOffset), 1);
+                Requests.Notify();
+                Responses.Notify();
+                Sender.Notify();
+            }
+
+            public bool Closed => pointer == null || Volatile.Read(ref *(int*)(pointer + ClosedOffset)) != 0;
+
+            public Ring Requests { get; }
+            public Ring Responses { get; }
+            public Ring Sender { get; }
+
+            private byte* pointer;
+            private readonly MemoryMappedFile mapping;
+            private readonly MemoryMappedViewAccessor view;
+
+            private const uint Magic = 0x52454E4F; // "RENO"
+            private const uint Version = 1;
+            private const int MagicOffset = 0;
+            private const int VersionOffset = 4;
+            private const int ClosedOffset = 8;
+            private const int RequestsOffset = 64;
+            private const int ResponsesOffset = 256;
+            private const int SenderOffset = 448;
+            private const int RingsOffset = 4096;
+        }
+
+        // Single-producer single-consumer byte ring, see ShmCommunicationChannel::read and write:
+        // `head` and `tail` count all the bytes written and read, `sequence` is bumped after every
+        // update of either of them and is the futex word the other side sleeps on
+        private unsafe class Ring
+        {
+            public Ring(byte* segment, int headerOffset, int dataOffset, int size)
+            {
+                var header = segment + headerOffset;
+                head = (long*)(header + HeadOffset);
+                tail = (long*)(header + TailOffset);
+                sequence = (int*)(header + SequenceOffset);
+                waiters = (int*)(header + WaitersOffset);
+                *(uint*)(header + DataOffsetOffset) = (uint)dataOffset;
+                *(uint*)(header + SizeOffset) = (uint)size;
+                data = segment + dataOffset;
+                this.size = size;
+            }
+
+            // Writes `count` bytes of `buffer` to the ring or reads them from it
+            public bool TryTransfer(byte[] buffer, int count, bool write, int timeoutInMilliseconds, Func<bool> isPeerAlive)
+            {
+                var stopwatch = Stopwatch.StartNew();
+                // Only this side updates its own counter
+                var own = write ? head : tail;
+                var position = *own;
+                var done = 0;
+
+                while(done < count)
+                {
+                    var currentSequence = Volatile.Read(ref *sequence);
+                    var available = write
+                        ? size - (position - Volatile.Read(ref *tail))
+                        : Volatile.Read(ref *head) - position;
+                    if(available == 0)
+                    {
+                        if(!isPeerAlive() || !Wait(currentSequence, stopwatch, timeoutInMilliseconds))
+                        {
+                            return false;
+                        }
+                        continue;
+                    }
+
+                    var offset = (int)(position & (size - 1));
+                    var chunk = (int)Math.Min(Math.Min(count - done, available), size - offset);
+                    if(write)
+                    {
+                        Marshal.Copy(buffer, done, (IntPtr)(data + offset), chunk);
+                    }
+                    else
+                    {
+                        Marshal.Copy((IntPtr)(data + offset), buffer, done, chunk);
+                    }
+                    done += chunk;
+                    position += chunk;
+                    Volatile.Write(ref *own, position);
+                    Notify();
+                }
+                return true;
+            }
+
+            public void Notify()
+            {
+                Interlocked.Increment(ref *sequence);
+                if(Volatile.Read(ref *waiters) > 0)
+                {
+                    Futex(sequence, FutexWake, int.MaxValue, null);
+                }
+            }
+
+            private bool Wait(int currentSequence, Stopwatch stopwatch, int timeoutInMilliseconds)
+            {
+                for(var i = 0; i < SpinCount; i++)
+                {
+                    if(Volatile.Read(ref *sequence) != currentSequence)
+                    {
+                        return true;
+                    }
+                    Thread.SpinWait(1);
+                }
+                if(timeoutInMilliseconds != Timeout.Infinite && stopwatch.ElapsedMilliseconds >= timeoutInMilliseconds)
+                {
+                    return false;
+                }
+
+                // Sleeping is time-limited to notice the other side exiting
+                var sleep = new Timespec { Seconds = 0, Nanoseconds = WaitTimeoutNanoseconds };
+                Interlocked.Increment(ref *waiters);
+                Futex(sequence, FutexWait, currentSequence, &sleep);
+                Interlocked.Decrement(ref *waiters);
+                return true;
+            }
+
+            private static void Futex(int* address, int operation, int value, Timespec* timeout)
+            {
+                syscall(FutexSyscall, address, operation, value, timeout, IntPtr.Zero, 0);
+            }
+
+            private static long GetFutexSyscall()
+            {
+                // struct utsname of Linux holds six strings of 65 characters, `machine` is the fifth one
+                var utsname = stackalloc byte[6 * 65];
+                var machine = uname(utsname) == 0 ? Marshal.PtrToStringAnsi((IntPtr)(utsname + 4 * 65)) : "";
+                if(machine == "aarch64")
+                {
+                    return 98;
+                }
+                if(machine.StartsWith("arm") || (machine.StartsWith("i") && machine.EndsWith("86")))
+                {
+                    return 240;
+                }
+                return 202; // x86_64
+            }
+
+            [DllImport("libc")]
+            private static extern int uname(byte* buffer);
+
+            [DllImport("libc", SetLastError = true)]
+            private static extern long syscall(long number, int* address, int operation, int value, Timespec* timeout, IntPtr address2, int value3);
+
+            private readonly long* head;
+            private readonly long* tail;
+            private readonly int* sequence;
+            private readonly int* waiters;
+            private readonly byte* data;
+            private readonly long size;
+
+            private static readonly int SpinCount = Environment.ProcessorCount > 1 ? 4096 : 0;
+            private static readonly long FutexSyscall = GetFutexSyscall();
+
+            private const int HeadOffset = 0;
+            private const int TailOffset = 64;
+            private const int SequenceOffset = 128;
+            private const int WaitersOffset = 132;
+            private const int DataOffsetOffset = 136;
+            private const int SizeOffset = 140;
+            private const int FutexWait = 0;
+            private const int FutexWake = 1;
+            private const long WaitTimeoutNanoseconds = 1000000;
+
+            [StructLayout(LayoutKind.Sequential)]
+            private struct Timespec
+            {
+                public long Seconds;
+                public long Nanoseconds;
+            }
+        }
+    }
+}
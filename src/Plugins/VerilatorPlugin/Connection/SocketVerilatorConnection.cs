@@ -88,6 +88,11 @@ public bool TrySendMessage(ProtocolMessage message)
             return mainSocketComunicator.TrySendMessage(message);
         }
 
+        public bool TrySendMessage(ProtocolMessage message, ProtocolMessage[] payload)
+        {
+            return mainSocketComunicator.TrySendMessages(message, payload);
+        }
+
         public bool TryRespond(ProtocolMessage message)
         {
             return TrySendMessage(message);
@@ -158,6 +163,10 @@ public string SimulationFilePath
             }
         }
 
+        public ProtocolExtensions OfferedExtensions { get; set; } = DefaultExtensions;
+
+        public ProtocolExtensions Extensions { get; private set; }
+
         private void ReceiveLoop()
         {
             while(!disposeInitiated && asyncSocketComunicator.Connected)
@@ -239,9 +248,17 @@ private void KillVerilatedProcess()
 
         private bool TryHandshake()
         {
-            return TrySendMessage(new ProtocolMessage(ActionType.Handshake, 0, 0))
-                   && TryReceiveMessage(out var result)
-                   && result.ActionId == ActionType.Handshake;
+            // Older verilated peripherals ignore the requested extensions and respond with 0
+            if(!TrySendMessage(new ProtocolMessage(ActionType.Handshake, 0, (ulong)OfferedExtensions))
+               || !TryReceiveMessage(out var result)
+               || result.ActionId != ActionType.Handshake)
+            {
+                return false;
+            }
+
+            Extensions = (ProtocolExtensions)result.Data & OfferedExtensions;
+            parentElement.Log(LogLevel.Debug, "Negotiated protocol extensions: {0}", Extensions);
+            return true;
         }
 
         private void HandleReceived(ProtocolMessage message)
@@ -280,6 +297,9 @@ private void HandleReceived(ProtocolMessage message)
         private readonly ManualResetEventSlim pauseMRES;
 
         private const string DefaultAddress = "127.0.0.1";
+        // Posted writes change the error handling of the peripheral and cycle offsets cost a message
+        // per timestamped event, so they're only offered if the peripheral asks for them
+        private const ProtocolExtensions DefaultExtensions = ProtocolExtensions.BatchedFrames | ProtocolExtensions.ActivityReports;
         private const int MaxPendingConnections = 1;
 
         private class SocketComunicator
@@ -348,6 +368,25 @@ public bool TrySendMessage(ProtocolMessage message)
                 return WaitSendOrReceiveTask(task, size);
             }
 
+            public bool TrySendMessages(ProtocolMessage message, ProtocolMessage[] payload)
+            {
+                // Messages are sent in one go to avoid a round trip per message
+                var messageSize = Marshal.SizeOf(message);
+                var serializedMessages = new byte[messageSize * (payload.Length + 1)];
+                Array.Copy(message.Serialize(), serializedMessages, messageSize);
+                for(var i = 0; i < payload.Length; i++)
+                {
+                    Array.Copy(payload[i].Serialize(), 0, serializedMessages, messageSize * (i + 1), messageSize);
+                }
+
+                var size = serializedMessages.Length;
+                var task = channelTaskFactory.FromAsync(
+                    (callback, state) => socket.BeginSend(serializedMessages, 0, size, SocketFlags.None, callback, state),
+                    socket.EndSend, state: null);
+
+                return WaitSendOrReceiveTask(task, size);
+            }
+
             public bool TryReceiveMessage(out ProtocolMessage message)
             {
                 message = default(ProtocolMessage);
@@ -356,6 +395,17 @@ public bool TryReceiveMessage(out ProtocolMessage message)
                 if(result)
                 {
                     message.Deserialize(buffer);
+                    if(message.ActionId == ActionType.Batch)
+                    {
+                        // Batch frame carries multiple messages, following receives are served from it
+                        // message.Address is the number of messages, message.Data is the frame size
+                        if(!TryReceiveFromSocket(out frame, (int)message.Data))
+                        {
+                            return false;
+                        }
+                        frameOffset = 0;
+                        return TryReceiveMessage(out message);
+                    }
                 }
                 return result;
             }
@@ -372,6 +422,34 @@ public bool TryReceiveString(out string message, int size)
             }
 
             public bool TryReceive(out byte[] buffer, int size)
+            {
+                if(frame == null)
+                {
+                    return TryReceiveFromSocket(out buffer, size);
+                }
+
+                buffer = null;
+                if(frameOffset + size > frame.Length)
+                {
+                    logger.DebugLog("Malformed batch frame!");
+                    frame = null;
+                    return false;
+                }
+
+                buffer = new byte[size];
+                Array.Copy(frame, frameOffset, buffer, 0, size);
+                frameOffset += size;
+                if(frameOffset == frame.Length)
+                {
+                    frame = null;
+                }
+                return true;
+            }
+
+            public int ListenerPort { get; private set; }
+            public bool Connected => socket.Connected;
+
+            private bool TryReceiveFromSocket(out byte[] buffer, int size)
             {
                 buffer = null;
                 var taskBuffer = new byte[size];
@@ -387,9 +465,6 @@ public bool TryReceive(out byte[] buffer, int size)
                 return isSuccess;
             }
 
-            public int ListenerPort { get; private set; }
-            public bool Connected => socket.Connected;
-
             private int CreateListenerAndStartListening()
             {
                 listener = new Socket(AddressFamily.InterNetwork, SocketType.Stream, ProtocolType.Tcp);
@@ -431,6 +506,8 @@ private bool WaitSendOrReceiveTask(Task<int> task, int size)
 
             private Socket listener;
             private Socket socket;
+            private byte[] frame;
+            private int frameOffset;
 
             private readonly int timeout;
             private readonly string address;
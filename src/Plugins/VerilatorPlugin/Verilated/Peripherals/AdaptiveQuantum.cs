@@ -0,0 +1,62 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+using System;
+
+namespace Antmicro.Renode.Peripherals.Verilated
+{
+    // Chooses the number of cycles to simulate in the next tick of a verilated peripheral
+    // based on the activity it reported for the last one: the quantum doubles after every
+    // quantum without any activity and shrinks proportionally when there's more activity
+    // than TargetActivity, so that bursts are simulated with fine-grained synchronization.
+    public class AdaptiveQuantum
+    {
+        public AdaptiveQuantum(ulong initial, ulong minimum, ulong maximum, ulong targetActivity = DefaultTargetActivity)
+        {
+            TargetActivity = Math.Max(targetActivity, 1);
+            Quantum = initial;
+            SetRange(minimum, maximum);
+        }
+
+        // Can be changed while the quantum is adjusted, the current one is clamped to the new range
+        public ulong SetRange(ulong minimum, ulong maximum)
+        {
+            if(minimum == 0 || minimum > maximum)
+            {
+                throw new ArgumentException($"Invalid quantum range: [{minimum}, {maximum}]");
+            }
+            Minimum = minimum;
+            Maximum = maximum;
+            Quantum = Clamp(Quantum);
+            return Quantum;
+        }
+
+        public ulong Update(ulong activity)
+        {
+            if(activity == 0)
+            {
+                Quantum = Clamp(Quantum > Maximum / 2 ? Maximum : Quantum * 2);
+            }
+            else if(activity > TargetActivity)
+            {
+                Quantum = Clamp((ulong)((double)Quantum * TargetActivity / activity));
+            }
+            return Quantum;
+        }
+
+        public ulong Quantum { get; private set; }
+        public ulong Minimum { get; private set; }
+        public ulong Maximum { get; private set; }
+        public ulong TargetActivity { get; }
+
+        public const ulong DefaultTargetActivity = 16;
+
+        private ulong Clamp(ulong quantum)
+        {
+            return Math.Min(Math.Max(quantum, Minimum), Maximum);
+        }
+    }
+}
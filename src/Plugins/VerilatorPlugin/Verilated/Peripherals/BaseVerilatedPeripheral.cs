@@ -5,7 +5,11 @@
 // Full license text is available in 'licenses/MIT.txt'.
 //
 using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
 using System.Threading;
+using Antmicro.Migrant.Hooks;
 using Antmicro.Renode.Core;
 using Antmicro.Renode.Exceptions;
 using Antmicro.Renode.Logging;
@@ -20,16 +24,22 @@ namespace Antmicro.Renode.Peripherals.Verilated
     public class BaseVerilatedPeripheral : IPeripheral, IDisposable, IHasOwnLife
     {
         public BaseVerilatedPeripheral(string simulationFilePathLinux = null, string simulationFilePathWindows = null, string simulationFilePathMacOS = null,
-            int timeout = DefaultTimeout, string address = null)
+            int timeout = DefaultTimeout, string address = null, Machine machine = null)
         {
             started = false;
-            if(address != null)
+            this.machine = machine;
+            invalidateOnWrite = (writeAddress, width, value) => QueueCacheInvalidation(writeAddress, (ulong)width);
+            if(address == SharedMemoryAddress)
             {
-                verilatorConnection = new SocketVerilatorConnection(this, timeout, HandleReceivedMessage, address);
+                verilatorConnection = new ShmVerilatorConnection(this, timeout, ReceiveMessage);
+            }
+            else if(address != null)
+            {
+                verilatorConnection = new SocketVerilatorConnection(this, timeout, ReceiveMessage, address);
             }
             else
             {
-                verilatorConnection = new LibraryVerilatorConnection(this, timeout, HandleReceivedMessage);
+                verilatorConnection = new LibraryVerilatorConnection(this, timeout, ReceiveMessage);
             }
 
             SimulationFilePathLinux = simulationFilePathLinux;
@@ -47,6 +57,16 @@ public virtual void Reset()
         public void Dispose()
         {
             disposeInitiated = true;
+            if(machine != null)
+            {
+                foreach(var region in cacheableRegions)
+                {
+                    for(var offset = 0UL; offset < region.Item2; offset++)
+                    {
+                        machine.SystemBus.RemoveWatchpointHook(region.Item1 + offset, invalidateOnWrite);
+                    }
+                }
+            }
             verilatorConnection.Dispose();
         }
 
@@ -102,6 +122,57 @@ public string SimulationFilePathMacOS
             }
         }
 
+        // Lets the verilated peripheral complete writes without waiting for the model, its failures are
+        // only logged then. It's negotiated when connecting, so it has to be set before SimulationFilePath.
+        public bool PostedWritesEnabled
+        {
+            get
+            {
+                return (verilatorConnection.OfferedExtensions & ProtocolExtensions.PostedWrites) != 0;
+            }
+            set
+            {
+                if(!String.IsNullOrWhiteSpace(simulationFilePath))
+                {
+                    LogAndThrowRE("Verilated peripheral already connected, set PostedWritesEnabled before SimulationFilePath!");
+                }
+                if(value)
+                {
+                    verilatorConnection.OfferedExtensions |= ProtocolExtensions.PostedWrites;
+                }
+                else
+                {
+                    verilatorConnection.OfferedExtensions &= ~ProtocolExtensions.PostedWrites;
+                }
+            }
+        }
+
+        // Makes the verilated peripheral timestamp the interrupt edges with their cycles of the quantum, at the cost
+        // of a message per edge. The model has to be built with cycleOffsets in AGENT_EXTENSIONS to accept it.
+        // It's negotiated when connecting, so it has to be set before SimulationFilePath.
+        public bool CycleOffsetsEnabled
+        {
+            get
+            {
+                return (verilatorConnection.OfferedExtensions & ProtocolExtensions.CycleOffsets) != 0;
+            }
+            set
+            {
+                if(!String.IsNullOrWhiteSpace(simulationFilePath))
+                {
+                    LogAndThrowRE("Verilated peripheral already connected, set CycleOffsetsEnabled before SimulationFilePath!");
+                }
+                if(value)
+                {
+                    verilatorConnection.OfferedExtensions |= ProtocolExtensions.CycleOffsets;
+                }
+                else
+                {
+                    verilatorConnection.OfferedExtensions &= ~ProtocolExtensions.CycleOffsets;
+                }
+            }
+        }
+
         public string SimulationFilePath
         {
             get
@@ -123,6 +194,19 @@ public string SimulationFilePath
                 {
                     verilatorConnection.SimulationFilePath = value;
                     simulationFilePath = value;
+
+                    foreach(var segment in sharedMemorySegments)
+                    {
+                        SendSharedMemorySegment(segment);
+                    }
+                    foreach(var region in cacheableRegions)
+                    {
+                        Send(ActionType.RegisterCacheableRegion, region.Item1, region.Item2);
+                    }
+                    if(statisticsEnabled)
+                    {
+                        Send(ActionType.EnableStatistics, 0, 1);
+                    }
                 }
             }
         }
@@ -143,12 +227,134 @@ public void Start()
 
         public void Send(ActionType actionId, ulong offset, ulong value)
         {
+            SendCacheInvalidations();
             if(!verilatorConnection.TrySendMessage(new ProtocolMessage(actionId, offset, value)))
             {
                 AbortAndLogError("Send error!");
             }
         }
 
+        public void Send(ActionType actionId, ulong offset, ulong value, ProtocolMessage[] payload)
+        {
+            SendCacheInvalidations();
+            if(!verilatorConnection.TrySendMessage(new ProtocolMessage(actionId, offset, value), payload))
+            {
+                AbortAndLogError("Send error!");
+            }
+        }
+
+        // Lets the verilated model cache reads from the given range of the system bus. The cache is
+        // write-through and writes of anyone else on the system bus of the machine passed to the constructor
+        // invalidate the cached copies before the next message to the model. Modifications bypassing the bus
+        // have to be followed by InvalidateCache.
+        public void RegisterCacheableRegion(ulong address, ulong size)
+        {
+            cacheableRegions.Add(Tuple.Create(address, size));
+            if(machine != null)
+            {
+                // Watchpoints are hit by accesses starting at their address, so every byte needs one
+                for(var offset = 0UL; offset < size; offset++)
+                {
+                    machine.SystemBus.AddWatchpointHook(address + offset, SysbusAccessWidth.Byte | SysbusAccessWidth.Word | SysbusAccessWidth.DoubleWord | SysbusAccessWidth.QuadWord, Access.Write, invalidateOnWrite);
+                }
+            }
+            if(!String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                Send(ActionType.RegisterCacheableRegion, address, size);
+            }
+        }
+
+        public void InvalidateCache(ulong address, ulong size)
+        {
+            if(!String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                Send(ActionType.InvalidateCachedRange, address, size);
+            }
+        }
+
+        // Maps `size` bytes of guest memory starting at `address` directly into the verilated model.
+        // The memory has to be backed by `path` at `offset`, e.g. /proc/<pid>/fd/<fd> of a memfd
+        // or a file in /dev/shm. Accesses of the model to this range bypass Renode completely.
+        public void MapSharedMemory(ulong address, ulong size, string path, ulong offset = 0)
+        {
+            var segment = new SharedMemorySegment { Address = address, Size = size, Path = path, Offset = offset };
+            sharedMemorySegments.Add(segment);
+            if(!String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                SendSharedMemorySegment(segment);
+            }
+        }
+
+        // Makes the verilated model gather request counts, latencies and cycles simulated.
+        // The report is logged on LogStatistics and when the model disconnects.
+        public void EnableStatistics(bool enabled)
+        {
+            statisticsEnabled = enabled;
+            if(!String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                Send(ActionType.EnableStatistics, 0, enabled ? 1UL : 0UL);
+            }
+        }
+
+        public void LogStatistics()
+        {
+            if(String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                this.Log(LogLevel.Warning, "Cannot get statistics. Set SimulationFilePath first!");
+                return;
+            }
+            Send(ActionType.GetStatistics, 0, 0);
+        }
+
+        // Saves the state of the verilated model and its agent into a binary blob which LoadState
+        // restores in the same model, e.g. in a new process. It's only complete if the model
+        // registers its state with the agent. The state of Renode, including the memory used
+        // by the model, has to be saved along with it.
+        public byte[] SaveState()
+        {
+            if(String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                LogAndThrowRE("Cannot save the state. Set SimulationFilePath first!");
+            }
+            Send(ActionType.SaveState, 0, 0);
+            var response = Receive();
+            if(response.ActionId != ActionType.SaveState)
+            {
+                LogAndThrowRE("Unable to save the state of the verilated peripheral");
+            }
+
+            var result = new byte[response.Data];
+            for(var i = 0; i < result.Length; i += ProtocolMessage.BlockDataSize)
+            {
+                Receive().UnpackBlock(result, i);
+            }
+            return result;
+        }
+
+        // The verilated peripheral keeps its current state if the given one is rejected
+        public void LoadState(byte[] state)
+        {
+            if(String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                LogAndThrowRE("Cannot load the state. Set SimulationFilePath first!");
+            }
+            Send(ActionType.LoadState, 0, (ulong)state.Length, ProtocolMessage.PackBlock(state, 0, state.Length));
+            if(Receive().ActionId != ActionType.OK)
+            {
+                LogAndThrowRE("Unable to load the state of the verilated peripheral");
+            }
+        }
+
+        public void SaveStateToFile(string path)
+        {
+            File.WriteAllBytes(path, SaveState());
+        }
+
+        public void LoadStateFromFile(string path)
+        {
+            LoadState(File.ReadAllBytes(path));
+        }
+
         public void Respond(ActionType actionId, ulong offset, ulong value)
         {
             if(!verilatorConnection.TryRespond(new ProtocolMessage(actionId, offset, value)))
@@ -177,6 +383,8 @@ public void HandleMessage()
         }
         
         public const int DefaultTimeout = 3000;
+        // Passed as `address` to connect to the verilated peripheral through shared memory instead of sockets
+        public const string SharedMemoryAddress = "shm";
 
         protected virtual void HandleInterrupt(ProtocolMessage interrupt)
         {
@@ -214,16 +422,131 @@ protected void AbortAndLogError(string message)
             throw new CpuAbortException();
         }
         
+        // The writes may happen on any thread, so they're sent along with the next message of the owner of the connection
+        protected void SendCacheInvalidations()
+        {
+            lock(pendingInvalidations)
+            {
+                // The cache is empty until the model is connected
+                if(String.IsNullOrWhiteSpace(simulationFilePath))
+                {
+                    pendingInvalidations.Clear();
+                    return;
+                }
+                foreach(var range in pendingInvalidations)
+                {
+                    if(!verilatorConnection.TrySendMessage(new ProtocolMessage(ActionType.InvalidateCachedRange, range.Item1, range.Item2)))
+                    {
+                        AbortAndLogError("Send error!");
+                    }
+                }
+                pendingInvalidations.Clear();
+            }
+        }
+
         protected string simulationFilePath;
         protected IVerilatorConnection verilatorConnection;
 
+        // The state of the model is saved together with the emulation, it's only kept for the serialization
+        [PreSerialization]
+        private void SaveModelState()
+        {
+            if(!String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                modelState = SaveState();
+            }
+        }
+
+        [PostSerialization]
+        private void DropModelState()
+        {
+            modelState = null;
+        }
+
+        [PostDeserialization]
+        private void RestoreModelState()
+        {
+            if(modelState != null && !String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                LoadState(modelState);
+            }
+            modelState = null;
+        }
+
+        private void ReceiveMessage(ProtocolMessage message)
+        {
+            // Writes done while handling the message come from the model, its cache is already up to date
+            receivingThread = Thread.CurrentThread;
+            try
+            {
+                HandleReceivedMessage(message);
+            }
+            finally
+            {
+                receivingThread = null;
+            }
+        }
+
+        private void QueueCacheInvalidation(ulong address, ulong size)
+        {
+            if(receivingThread == Thread.CurrentThread)
+            {
+                return;
+            }
+            lock(pendingInvalidations)
+            {
+                // Consecutive writes, e.g. of a DMA transfer, are sent as one range
+                var last = pendingInvalidations.Count - 1;
+                if(last >= 0 && pendingInvalidations[last].Item1 + pendingInvalidations[last].Item2 == address)
+                {
+                    pendingInvalidations[last] = Tuple.Create(pendingInvalidations[last].Item1, pendingInvalidations[last].Item2 + size);
+                }
+                else
+                {
+                    pendingInvalidations.Add(Tuple.Create(address, size));
+                }
+            }
+        }
+
+        private void SendSharedMemorySegment(SharedMemorySegment segment)
+        {
+            // SharedMemoryMapping followed by a null-terminated path
+            var path = Encoding.UTF8.GetBytes(segment.Path);
+            var payload = new byte[16 + path.Length + 1];
+            BitConverter.GetBytes(segment.Size).CopyTo(payload, 0);
+            BitConverter.GetBytes(segment.Offset).CopyTo(payload, 8);
+            path.CopyTo(payload, 16);
+
+            Send(ActionType.RegisterSharedMemory, segment.Address, (ulong)payload.Length, ProtocolMessage.PackBlock(payload, 0, payload.Length));
+            if(Receive().ActionId != ActionType.OK)
+            {
+                this.Log(LogLevel.Warning, "Unable to map shared memory at 0x{0:X} from '{1}', falling back to messages", segment.Address, segment.Path);
+            }
+        }
+
         private void LogAndThrowRE(string info)
         {
             this.Log(LogLevel.Error, info);
             throw new RecoverableException(info);
         }
 
+        private readonly List<SharedMemorySegment> sharedMemorySegments = new List<SharedMemorySegment>();
+        private readonly List<Tuple<ulong, ulong>> cacheableRegions = new List<Tuple<ulong, ulong>>();
+        private readonly List<Tuple<ulong, ulong>> pendingInvalidations = new List<Tuple<ulong, ulong>>();
+        private readonly BusHookDelegate invalidateOnWrite;
+        private readonly Machine machine;
+        private Thread receivingThread;
+        private bool statisticsEnabled;
+        private byte[] modelState;
         private bool started;
         private bool disposeInitiated;
+
+        private struct SharedMemorySegment
+        {
+            public ulong Address;
+            public ulong Size;
+            public string Path;
+            public ulong Offset;
+        }
     }
 }
@@ -33,7 +33,7 @@ public abstract class VerilatedCPU : BaseCPU, IGPIOReceiver, ITimeSink, IDisposa
             string simulationFilePathLinux = null, string simulationFilePathWindows = null, string simulationFilePathMacOS = null, string address = null)
             : base(0, cpuType, machine, endianness, bitness)
         {
-            verilatedPeripheral = new BaseVerilatedPeripheral(simulationFilePathLinux, simulationFilePathWindows, simulationFilePathMacOS, BaseVerilatedPeripheral.DefaultTimeout, address);
+            verilatedPeripheral = new BaseVerilatedPeripheral(simulationFilePathLinux, simulationFilePathWindows, simulationFilePathMacOS, BaseVerilatedPeripheral.DefaultTimeout, address, machine);
             verilatedPeripheral.OnReceive = HandleReceived;
 
             InitializeRegisters();
@@ -117,6 +117,46 @@ public virtual uint GetRegisterValue32(int register)
             }
         }
 
+        public void MapSharedMemory(ulong address, ulong size, string path, ulong offset = 0)
+        {
+            lock(verilatedPeripheralLock)
+            {
+                verilatedPeripheral.MapSharedMemory(address, size, path, offset);
+            }
+        }
+
+        public void RegisterCacheableRegion(ulong address, ulong size)
+        {
+            lock(verilatedPeripheralLock)
+            {
+                verilatedPeripheral.RegisterCacheableRegion(address, size);
+            }
+        }
+
+        public void InvalidateCache(ulong address, ulong size)
+        {
+            lock(verilatedPeripheralLock)
+            {
+                verilatedPeripheral.InvalidateCache(address, size);
+            }
+        }
+
+        public void EnableStatistics(bool enabled)
+        {
+            lock(verilatedPeripheralLock)
+            {
+                verilatedPeripheral.EnableStatistics(enabled);
+            }
+        }
+
+        public void LogStatistics()
+        {
+            lock(verilatedPeripheralLock)
+            {
+                verilatedPeripheral.LogStatistics();
+            }
+        }
+
         protected abstract void InitializeRegisters();
 
         public override ExecutionMode ExecutionMode
@@ -227,6 +267,26 @@ protected void HandleReceived(ProtocolMessage message)
                     this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}", message.Data, message.Address);
                     machine.SystemBus.WriteDoubleWord(message.Address, (uint)message.Data);
                     break;
+                case ActionType.PushDoubleWordMasked:
+                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} with byte mask 0x{1:X} to address: 0x{2:X}", (uint)message.Data, message.Data >> ProtocolMessage.PushMaskShift, message.Address);
+                    WriteDoubleWordMasked(message.Address, (uint)message.Data, (byte)(message.Data >> ProtocolMessage.PushMaskShift));
+                    break;
+                case ActionType.GetByte:
+                    this.Log(LogLevel.Noisy, "Requested byte from address: 0x{0:X}", message.Address);
+                    var byteData = machine.SystemBus.ReadByte(message.Address);
+                    lock(verilatedPeripheralLock)
+                    {
+                        verilatedPeripheral.Respond(ActionType.WriteToBus, 0, byteData);
+                    }
+                    break;
+                case ActionType.GetWord:
+                    this.Log(LogLevel.Noisy, "Requested word from address: 0x{0:X}", message.Address);
+                    var wordData = machine.SystemBus.ReadWord(message.Address);
+                    lock(verilatedPeripheralLock)
+                    {
+                        verilatedPeripheral.Respond(ActionType.WriteToBus, 0, wordData);
+                    }
+                    break;
                 case ActionType.GetDoubleWord:
                     this.Log(LogLevel.Noisy, "Requested data from address: 0x{0:X}", message.Address);
                     var data = machine.SystemBus.ReadDoubleWord(message.Address);
@@ -235,7 +295,20 @@ protected void HandleReceived(ProtocolMessage message)
                         verilatedPeripheral.Respond(ActionType.WriteToBus, 0, data);
                     }
                     break;
+                case ActionType.GetBlock:
+                    this.Log(LogLevel.Noisy, "Requested {0} bytes from address: 0x{1:X}", message.Data, message.Address);
+                    var block = machine.SystemBus.ReadBytes(message.Address, (int)message.Data);
+                    lock(verilatedPeripheralLock)
+                    {
+                        foreach(var record in ProtocolMessage.PackBlock(block, 0, block.Length))
+                        {
+                            verilatedPeripheral.Respond(record.ActionId, record.Address, record.Data);
+                        }
+                    }
+                    break;
                 case ActionType.TickClock:
+                    // The activity reported in Address isn't used, the number of instructions
+                    // to execute is chosen by the CPU's execution loop
                     ticksProcessed = true;
                     instructionsExecutedThisRound = message.Data;
                     break;
@@ -253,6 +326,9 @@ protected void HandleReceived(ProtocolMessage message)
                 case ActionType.SingleStepMode:
                     gotSingleStepMode = true;
                     break;
+                case ActionType.CycleOffset:
+                    // Memory accesses are applied in order as they arrive, the timestamps aren't needed
+                    break;
                 case ActionType.Step:
                     gotStep = true;
                     instructionsExecutedThisRound = message.Data;
@@ -322,6 +398,32 @@ public string SimulationFilePath
             }
         }
         
+        private void WriteDoubleWordMasked(ulong address, uint value, byte mask)
+        {
+            // Unselected bytes mustn't be accessed at all, they may belong to registers with side effects
+            switch(mask & 0xF)
+            {
+                case 0xF:
+                    machine.SystemBus.WriteDoubleWord(address, value);
+                    break;
+                case 0x3:
+                    machine.SystemBus.WriteWord(address, (ushort)value);
+                    break;
+                case 0xC:
+                    machine.SystemBus.WriteWord(address + 2, (ushort)(value >> 16));
+                    break;
+                default:
+                    for(var i = 0; i < 4; i++)
+                    {
+                        if((mask & (1 << i)) != 0)
+                        {
+                            machine.SystemBus.WriteByte(address + (ulong)i, (byte)(value >> (8 * i)));
+                        }
+                    }
+                    break;
+            }
+        }
+
         protected readonly object verilatedPeripheralLock = new object();
 
         private readonly BaseVerilatedPeripheral verilatedPeripheral;
@@ -12,33 +12,49 @@
 using Antmicro.Renode.Exceptions;
 using Antmicro.Renode.Logging;
 using Antmicro.Renode.Peripherals.Bus;
+using Antmicro.Renode.Peripherals.CPU;
 using Antmicro.Renode.Peripherals.Timers;
+using Antmicro.Renode.Time;
 using Antmicro.Renode.Plugins.VerilatorPlugin.Connection;
 using Antmicro.Renode.Plugins.VerilatorPlugin.Connection.Protocols;
 
 namespace Antmicro.Renode.Peripherals.Verilated
 {
-    public class VerilatedPeripheral : BaseVerilatedPeripheral, IQuadWordPeripheral, IDoubleWordPeripheral, IWordPeripheral, IBytePeripheral, IBusPeripheral, IDisposable, IHasOwnLife, INumberedGPIOOutput
+    public class VerilatedPeripheral : BaseVerilatedPeripheral, IQuadWordPeripheral, IDoubleWordPeripheral, IWordPeripheral, IBytePeripheral, IMultibyteWritePeripheral, IBusPeripheral, IDisposable, IHasOwnLife, INumberedGPIOOutput
     {
         public VerilatedPeripheral(Machine machine, long frequency, int maxWidth, string simulationFilePathLinux = null, string simulationFilePathWindows = null, string simulationFilePathMacOS = null,
             ulong limitBuffer = LimitBuffer, int timeout = DefaultTimeout, string address = null, int numberOfInterrupts = 0)
-            : base(simulationFilePathLinux, simulationFilePathWindows, simulationFilePathMacOS, timeout, address)
+            : base(simulationFilePathLinux, simulationFilePathWindows, simulationFilePathMacOS, timeout, address, machine)
         {
             this.machine = machine;
+            this.frequency = frequency;
             allTicksProcessedARE = new AutoResetEvent(initialState: false);
             this.OnReceive = HandleReceivedMessage;
             this.maxWidth = maxWidth;
+            this.limitBuffer = limitBuffer;
+            nextQuantum = limitBuffer;
 
             timer = new LimitTimer(machine.ClockSource, frequency, this, LimitTimerName, limitBuffer, enabled: false, eventEnabled: true, autoUpdate: true);
             timer.LimitReached += () =>
             {
-                if(!verilatorConnection.TrySendMessage(new ProtocolMessage(ActionType.TickClock, 0, limitBuffer)))
+                SendCacheInvalidations();
+                var quantum = timer.Limit;
+                cycleOffset = null;
+                ticking = true;
+                if(!verilatorConnection.TrySendMessage(new ProtocolMessage(ActionType.TickClock, 0, quantum)))
                 {
                     AbortAndLogError("Send error!");
                 }
                 this.NoisyLog("Tick: TickClock sent, waiting for the verilated peripheral...");
                 allTicksProcessedARE.WaitOne();
                 this.NoisyLog("Tick: Verilated peripheral finished evaluating the model.");
+                ScheduleInterrupts(quantum);
+                // Changed here rather than when the response arrives, on the thread owning the timer
+                if(timer.Limit != nextQuantum)
+                {
+                    this.NoisyLog("Tick: quantum changed to {0} cycles", nextQuantum);
+                    timer.Limit = nextQuantum;
+                }
             };
 
             timer.Enabled = true;
@@ -126,6 +142,43 @@ public virtual void WriteQuadWord(long offset, ulong value)
             }
         }
 
+        public virtual byte[] ReadBytes(long offset, int count, ICPU context = null)
+        {
+            var result = new byte[count];
+            if(String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                this.Log(LogLevel.Warning, "Cannot read from peripheral. Set SimulationFilePath first!");
+                return result;
+            }
+            Send(ActionType.ReadFromBusBlock, (ulong)offset, (ulong)count);
+            // The data only follows a successful read
+            if(Receive().ActionId != ActionType.ReadFromBusBlock)
+            {
+                this.Log(LogLevel.Warning, "Unable to read {0} bytes at 0x{1:X} from the verilated peripheral", count, offset);
+                return result;
+            }
+
+            for(var i = 0; i < count; i += ProtocolMessage.BlockDataSize)
+            {
+                Receive().UnpackBlock(result, i);
+            }
+            return result;
+        }
+
+        public virtual void WriteBytes(long offset, byte[] array, int startingIndex, int count, ICPU context = null)
+        {
+            if(String.IsNullOrWhiteSpace(simulationFilePath))
+            {
+                this.Log(LogLevel.Warning, "Cannot write to peripheral. Set SimulationFilePath first!");
+                return;
+            }
+            Send(ActionType.WriteToBusBlock, (ulong)offset, (ulong)count, ProtocolMessage.PackBlock(array, startingIndex, count));
+            if(!PostedWrites)
+            {
+                CheckValidation(Receive());
+            }
+        }
+
         public override void HandleReceivedMessage(ProtocolMessage message)
         {
             switch(message.ActionId)
@@ -136,24 +189,74 @@ public override void HandleReceivedMessage(ProtocolMessage message)
                 case ActionType.Interrupt:
                     HandleInterrupt(message);
                     break;
+                case ActionType.CycleOffset:
+                    cycleOffset = message.Data;
+                    break;
+                case ActionType.Error:
+                    // Only posted writes are reported this way, the emulation has already moved on
+                    this.Log(LogLevel.Error, "Write to offset 0x{0:X} failed", message.Address);
+                    break;
                 case ActionType.PushByte:
-                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}", message.Data, message.Address);
+                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}{2}", message.Data, message.Address, AtCycle);
                     machine.SystemBus.WriteByte(message.Address, (byte)message.Data);
                     break;
                 case ActionType.PushWord:
-                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}", message.Data, message.Address);
+                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}{2}", message.Data, message.Address, AtCycle);
                     machine.SystemBus.WriteWord(message.Address, (ushort)message.Data);
                     break;
                 case ActionType.PushDoubleWord:
-                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}", message.Data, message.Address);
+                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} to address: 0x{1:X}{2}", message.Data, message.Address, AtCycle);
                     machine.SystemBus.WriteDoubleWord(message.Address, (uint)message.Data);
                     break;
+                case ActionType.PushDoubleWordMasked:
+                    this.Log(LogLevel.Noisy, "Writing data: 0x{0:X} with byte mask 0x{1:X} to address: 0x{2:X}{3}", (uint)message.Data, message.Data >> ProtocolMessage.PushMaskShift, message.Address, AtCycle);
+                    WriteDoubleWordMasked(message.Address, (uint)message.Data, (byte)(message.Data >> ProtocolMessage.PushMaskShift));
+                    break;
+                case ActionType.GetByte:
+                    this.Log(LogLevel.Noisy, "Requested byte from address: 0x{0:X}", message.Address);
+                    Respond(ActionType.WriteToBus, 0, machine.SystemBus.ReadByte(message.Address));
+                    break;
+                case ActionType.GetWord:
+                    this.Log(LogLevel.Noisy, "Requested word from address: 0x{0:X}", message.Address);
+                    Respond(ActionType.WriteToBus, 0, machine.SystemBus.ReadWord(message.Address));
+                    break;
                 case ActionType.GetDoubleWord:
                     this.Log(LogLevel.Noisy, "Requested data from address: 0x{0:X}", message.Address);
                     var data = machine.SystemBus.ReadDoubleWord(message.Address);
                     Respond(ActionType.WriteToBus, 0, data);
                     break;
+                case ActionType.GetBlock:
+                    this.Log(LogLevel.Noisy, "Requested {0} bytes from address: 0x{1:X}", message.Data, message.Address);
+                    var block = machine.SystemBus.ReadBytes(message.Address, (int)message.Data);
+                    foreach(var record in ProtocolMessage.PackBlock(block, 0, block.Length))
+                    {
+                        Respond(record.ActionId, record.Address, record.Data);
+                    }
+                    break;
+                case ActionType.PushBlock:
+                    this.Log(LogLevel.Noisy, "Writing {0} bytes to address: 0x{1:X}", message.Data, message.Address);
+                    pushedBlock = new byte[message.Data];
+                    pushedBlockAddress = message.Address;
+                    pushedBlockOffset = 0;
+                    break;
+                case ActionType.BlockData:
+                    if(pushedBlock == null)
+                    {
+                        this.Log(LogLevel.Warning, "Unexpected block data received");
+                        break;
+                    }
+                    message.UnpackBlock(pushedBlock, pushedBlockOffset);
+                    pushedBlockOffset += ProtocolMessage.BlockDataSize;
+                    if(pushedBlockOffset >= pushedBlock.Length)
+                    {
+                        machine.SystemBus.WriteBytes(pushedBlock, pushedBlockAddress);
+                        pushedBlock = null;
+                    }
+                    break;
                 case ActionType.TickClock:
+                    ticking = false;
+                    cycleOffset = null;
+                    UpdateQuantum(message.Address);
                     allTicksProcessedARE.Set();
                     break;
                 default:
@@ -165,6 +268,44 @@ public override void HandleReceivedMessage(ProtocolMessage message)
 
         public IReadOnlyDictionary<int, IGPIO> Connections { get; }
 
+        // The number of cycles simulated in a tick follows the activity of the verilated peripheral,
+        // between MinimumQuantum and MaximumQuantum, instead of being fixed to limitBuffer
+        public bool AdaptiveQuantumEnabled
+        {
+            get => adaptiveQuantum != null;
+            set
+            {
+                adaptiveQuantum = value ? new AdaptiveQuantum(limitBuffer, MinimumQuantum, MaximumQuantum) : null;
+                nextQuantum = limitBuffer;
+            }
+        }
+
+        public ulong MinimumQuantum
+        {
+            get => minimumQuantum;
+            set
+            {
+                SetQuantumRange(value, maximumQuantum);
+                minimumQuantum = value;
+            }
+        }
+
+        public ulong MaximumQuantum
+        {
+            get => maximumQuantum;
+            set
+            {
+                SetQuantumRange(minimumQuantum, value);
+                maximumQuantum = value;
+            }
+        }
+
+        // Negotiated with the verilated peripheral, Renode doesn't wait for writes to complete
+        protected bool PostedWrites => (verilatorConnection.Extensions & ProtocolExtensions.PostedWrites) != 0;
+
+        // When the event being handled happened in the model, if it's timestamped
+        protected string AtCycle => cycleOffset.HasValue ? $" at cycle {cycleOffset} of the quantum" : String.Empty;
+
         protected bool VerifyLength(int length, long offset, ulong? value = null)
         {
             if(length > maxWidth)
@@ -189,7 +330,10 @@ protected void Write(ActionType type, long offset, ulong value)
                 return;
             }
             Send(type, (ulong)offset, value);
-            CheckValidation(Receive());
+            if(!PostedWrites)
+            {
+                CheckValidation(Receive());
+            }
         }
 
         protected ulong Read(ActionType type, long offset)
@@ -214,16 +358,127 @@ protected override void HandleInterrupt(ProtocolMessage interrupt)
                 return;
             }
 
+            this.Log(LogLevel.Noisy, "Interrupt {0} set to {1}{2}", interrupt.Address, interrupt.Data, AtCycle);
+            if(ticking && cycleOffset.HasValue)
+            {
+                // Applied when the tick ends, edges raised outside of it (e.g. by an access) are applied right away
+                pendingInterrupts.Add(new PendingInterrupt { Offset = cycleOffset.Value, Connection = connection, State = interrupt.Data != 0 });
+                return;
+            }
             connection.Set(interrupt.Data != 0);
         }
 
+        private void ScheduleInterrupts(ulong quantum)
+        {
+            // The timer fires once the quantum the model has just simulated is over in the virtual time,
+            // so the edges are due at their cycle counted from its start, which has normally passed already
+            foreach(var edge in pendingInterrupts)
+            {
+                if(edge.Offset < quantum)
+                {
+                    edge.Connection.Set(edge.State);
+                    continue;
+                }
+                var connection = edge.Connection;
+                var state = edge.State;
+                machine.ScheduleAction(CyclesToTime(edge.Offset - quantum), _ => connection.Set(state));
+            }
+            pendingInterrupts.Clear();
+        }
+
+        // At the resolution of the virtual time, microseconds would move the edges
+        private TimeInterval CyclesToTime(ulong cycles)
+        {
+            return TimeInterval.FromTicks((ulong)((decimal)cycles * TicksPerSecond / frequency));
+        }
+
+        private void SetQuantumRange(ulong minimum, ulong maximum)
+        {
+            if(adaptiveQuantum != null)
+            {
+                nextQuantum = adaptiveQuantum.SetRange(minimum, maximum);
+            }
+        }
+
+        private void UpdateQuantum(ulong activity)
+        {
+            if(adaptiveQuantum == null)
+            {
+                return;
+            }
+            if((verilatorConnection.Extensions & ProtocolExtensions.ActivityReports) == 0)
+            {
+                this.Log(LogLevel.Warning, "The verilated peripheral doesn't report its activity, the quantum can't be adjusted");
+                adaptiveQuantum = null;
+                return;
+            }
+            nextQuantum = adaptiveQuantum.Update(activity);
+        }
+
+        private void WriteDoubleWordMasked(ulong address, uint value, byte mask)
+        {
+            // Unselected bytes mustn't be accessed at all, they may belong to registers with side effects
+            switch(mask & 0xF)
+            {
+                case 0xF:
+                    machine.SystemBus.WriteDoubleWord(address, value);
+                    break;
+                case 0x3:
+                    machine.SystemBus.WriteWord(address, (ushort)value);
+                    break;
+                case 0xC:
+                    machine.SystemBus.WriteWord(address + 2, (ushort)(value >> 16));
+                    break;
+                default:
+                    for(var i = 0; i < 4; i++)
+                    {
+                        if((mask & (1 << i)) != 0)
+                        {
+                            machine.SystemBus.WriteByte(address + (ulong)i, (byte)(value >> (8 * i)));
+                        }
+                    }
+                    break;
+            }
+        }
+
         protected readonly Machine machine;
         protected readonly int maxWidth;
 
         protected const ulong LimitBuffer = 1000000;
+        protected const ulong DefaultMinimumQuantum = 1000;
+        protected const ulong DefaultMaximumQuantum = 100000000;
+
+        // Block pushed by the agent, assembled from the BlockData messages following PushBlock
+        private byte[] pushedBlock;
+        private ulong pushedBlockAddress;
+        private int pushedBlockOffset;
+
+        // Set by CycleOffset messages, valid until the end of the quantum
+        private ulong? cycleOffset;
+        // Set while the model simulates the quantum, until the response to TickClock arrives
+        private bool ticking;
+        // Edges reported during the tick, scheduled when it ends
+        private readonly List<PendingInterrupt> pendingInterrupts = new List<PendingInterrupt>();
+
+        private AdaptiveQuantum adaptiveQuantum;
+        private ulong minimumQuantum = DefaultMinimumQuantum;
+        private ulong maximumQuantum = DefaultMaximumQuantum;
+        // Set when the response to TickClock arrives, applied before the next tick
+        private ulong nextQuantum;
+        private readonly ulong limitBuffer;
+        private readonly long frequency;
 
         private readonly AutoResetEvent allTicksProcessedARE;
         private readonly LimitTimer timer;
         private const string LimitTimerName = "VerilatorIntegrationClock";
+
+        private static readonly ulong TicksPerSecond = TimeInterval.FromSeconds(1).Ticks;
+
+        private struct PendingInterrupt
+        {
+            public ulong Offset;
+            public IGPIO Connection;
+            public bool State;
+        }
     }
 }
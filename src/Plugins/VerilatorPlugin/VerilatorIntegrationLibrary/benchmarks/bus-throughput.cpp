@@ -0,0 +1,546 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+// Measures the throughput of every bus driven by the agent, with mock models
+// instead of verilated ones, over each of the loopback channels:
+//   loopback - messages passed with function calls
+//   native   - passed through the imports of the native mode, stubbed to call the loopback
+//   stream   - framed as over the sockets, without any extensions
+//   stream+  - framed as over the sockets, with all the extensions of the agent
+//   shm      - over the shared-memory rings, with all the extensions of the agent and
+//              Renode's side running on its own thread
+// Target buses serve alternating writes and reads from Renode, initiator buses are
+// ticked with tickClock requests while their models issue transactions back to back.
+// Finally, the results the agent delivers to Renode over each channel are checked (bus
+// round trips, memory written by an initiator and interrupts), as well as that its request
+// loop doesn't allocate memory once it's warmed up; the benchmark fails if they're wrong.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include "mock-models.h"
+#include "native-loopback-channel.h"
+#include "stream-loopback-channel.h"
+#include "shm-loopback-channel.h"
+
+#define TICK_QUANTUM 10000
+
+// Allocations are counted while `countAllocations` is set
+static bool countAllocations = false;
+static uint64_t allocations = 0;
+
+static void* allocate(size_t size)
+{
+    if(countAllocations)
+        allocations++;
+    if(void* memory = malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+// Kept out of line, otherwise GCC matches the inlined malloc and free against new and delete
+// at the call sites and warns about mismatched deallocations
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    return allocate(size);
+}
+
+__attribute__((noinline)) void* operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory) noexcept
+{
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete[](void* memory, size_t) noexcept
+{
+    free(memory);
+}
+
+RenodeAgent* Init()
+{
+    return nullptr;
+}
+
+class BenchmarkAgent : public RenodeAgent
+{
+public:
+    BenchmarkAgent(BaseTargetBus* bus, CommunicationChannel* channel) : RenodeAgent(bus)
+    {
+        communicationChannel = channel;
+    }
+
+    BenchmarkAgent(BaseInitiatorBus* bus, CommunicationChannel* channel) : RenodeAgent(bus)
+    {
+        communicationChannel = channel;
+    }
+};
+
+struct Result
+{
+    double seconds;
+    uint64_t transactions;
+    uint64_t cycles;
+    uint64_t messages;
+    bool valid;
+};
+
+static bool failed = false;
+
+static double elapsed(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void report(const char* bus, const char* channel, const Result& result)
+{
+    printf("%-20s %-10s %14.0f %14.0f %12.2f%s\n", bus, channel,
+        result.transactions / result.seconds, result.cycles / result.seconds,
+        result.transactions > 0 ? (double)result.messages / result.transactions : 0.0,
+        result.valid ? "" : "  INVALID");
+    failed |= !result.valid;
+}
+
+// Runs `benchmark(channel, renode)` over every channel
+template<typename Benchmark>
+static void forEachChannel(const char* bus, Benchmark benchmark)
+{
+    {
+        LoopbackCommunicationChannel renode;
+        report(bus, "loopback", benchmark(renode, renode));
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        NativeLoopbackChannel channel(renode);
+        report(bus, "native", benchmark(channel, renode));
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, 0);
+        report(bus, "stream", benchmark(channel, renode));
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        report(bus, "stream+", benchmark(channel, renode));
+    }
+#ifdef __linux__
+    {
+        LoopbackCommunicationChannel renode;
+        ShmLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        report(bus, "shm", benchmark(channel, renode));
+    }
+#endif
+}
+
+// Every read returns the value written by the preceding request
+template<typename Channel>
+static Result runTarget(BaseTargetBus* bus, MockModel& model, Channel& channel, LoopbackCommunicationChannel& renode, uint64_t transactions)
+{
+    BenchmarkAgent agent(bus, &channel);
+    Protocol request;
+    uint64_t cycles = model.cycles;
+    renode.messages = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < transactions; i++) {
+        uint64_t addr = (i / 2 * 4) % 256;
+        if(i % 2 == 0)
+            channel.request(Protocol(writeRequestDoubleWord, addr, i));
+        else
+            channel.request(Protocol(readRequestDoubleWord, addr, 0));
+        agent.receive(&request);
+        agent.handleRequest(&request);
+    }
+    channel.flush();
+    double seconds = elapsed(start);
+
+    bool valid = transactions < 2 || renode.responses.back().value == (transactions - 1) / 2 * 2;
+    return {seconds, transactions, model.cycles - cycles, renode.messages, valid};
+}
+
+template<typename Channel>
+static Result runInitiator(BaseInitiatorBus* bus, MockModel& model, Channel& channel, LoopbackCommunicationChannel& renode, uint64_t cycles)
+{
+    BenchmarkAgent agent(bus, &channel);
+    Protocol request;
+    uint64_t transactions = model.transactions;
+    uint64_t simulated = model.cycles;
+    renode.messages = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < cycles; i += TICK_QUANTUM) {
+        channel.request(Protocol(tickClock, 0, TICK_QUANTUM));
+        agent.receive(&request);
+        agent.handleRequest(&request);
+    }
+    channel.flush();
+    double seconds = elapsed(start);
+
+    transactions = model.transactions - transactions;
+    return {seconds, transactions, model.cycles - simulated, renode.messages, transactions > 0};
+}
+
+static Result runCfu(uint64_t transactions)
+{
+    CfuModel model;
+    Cfu cfu;
+    model.bind(&cfu);
+    bool valid = true;
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < transactions; i++) {
+        int error;
+        valid &= cfu.execute(0, i, 1, &error) == (uint32_t)(i + 1);
+    }
+    double seconds = elapsed(start);
+
+    return {seconds, transactions, model.cycles, 0, valid};
+}
+
+// Cost of the messages themselves: one-way pushes and getDoubleWord round trips
+template<typename Channel>
+static void runChannel(const char* name, Channel& channel, LoopbackCommunicationChannel& renode, uint64_t messages)
+{
+    AxiLiteModel model;
+    AxiLite* bus = new AxiLite();
+    model.bind(bus);
+    BenchmarkAgent agent(bus, &channel);
+
+    auto start = std::chrono::steady_clock::now();
+    for(uint64_t i = 0; i < messages; i++)
+        agent.pushDoubleWordToAgent(i * 4, i);
+    channel.flush();
+    double push = elapsed(start);
+
+    start = std::chrono::steady_clock::now();
+    uint64_t sum = 0;
+    for(uint64_t i = 0; i < messages; i++)
+        sum += agent.requestDoubleWordFromAgent(i * 4);
+    double roundTrip = elapsed(start);
+
+    bool valid = sum == messages * (messages - 1) / 2 || messages * 4 > renode.memory.size();
+    printf("%-10s %14.1f %14.1f%s\n", name, push * 1e9 / messages, roundTrip * 1e9 / messages, valid ? "" : "  INVALID");
+    failed |= !valid;
+}
+
+// What Renode gets over `channel`: read data written before, writes of an initiator
+// in its memory and the state of an interrupt line at the end of the quantum
+template<typename Channel>
+static void checkBehavior(const char* name, Channel& channel, LoopbackCommunicationChannel& renode)
+{
+    Protocol request;
+    bool valid = true;
+    auto handle = [&](BenchmarkAgent& agent, const Protocol message) {
+        channel.request(message);
+        agent.receive(&request);
+        agent.handleRequest(&request);
+        channel.flush();
+    };
+
+    {
+        ApbModel model;
+        APB3* bus = new APB3();
+        model.bind(bus);
+        BenchmarkAgent agent(bus, &channel);
+        handle(agent, Protocol(writeRequestDoubleWord, 0x10, 0xCAFE));
+        handle(agent, Protocol(readRequestDoubleWord, 0x10, 0));
+        valid &= renode.responses.back().actionId == readRequest && renode.responses.back().value == 0xCAFE;
+        handle(agent, Protocol(readRequestDoubleWord, 0x14, 0));
+        valid &= renode.responses.back().value == 0;
+
+        uint8_t line = 1;
+        agent.registerInterrupt(&line, 3);
+        handle(agent, Protocol(tickClock, 0, 10));
+        valid &= renode.interrupts.count(3) && renode.interrupts[3] == 1;
+        line = 0;
+        handle(agent, Protocol(tickClock, 0, 10));
+        valid &= renode.interrupts[3] == 0;
+        valid &= renode.notifications.back().actionId == tickClock;
+    }
+    {
+        // Odd transactions write their number to the next word, even ones read
+        WishboneInitiatorModel model;
+        WishboneInitiator<uint32_t, uint32_t>* bus = new WishboneInitiator<uint32_t, uint32_t>();
+        model.bind(bus);
+        BenchmarkAgent agent(bus, &channel);
+        handle(agent, Protocol(tickClock, 0, 100));
+        valid &= model.transactions > 2;
+        for(uint64_t i = 1; i < model.transactions; i += 2) {
+            uint32_t value;
+            memcpy(&value, renode.memory.data() + i * 4, sizeof(value));
+            valid &= value == i;
+        }
+    }
+
+    printf("%-10s %s\n", name, valid ? "ok" : "INVALID");
+    failed |= !valid;
+}
+
+// Renode's side reduced to replaying `script` in a loop and answering the reads of the
+// agent with zeros, in buffers allocated upfront, so that every allocation made while
+// the requests are handled comes from the agent and its StreamCommunicationChannel
+class ReplayChannel : public StreamCommunicationChannel
+{
+public:
+    ReplayChannel(std::vector<Protocol> script, uint64_t extensions)
+        : script(script), next(0), readOffset(0), payload(0)
+    {
+        // Enough for the replies to the largest block read of the buses
+        input.reserve(1 << 20);
+        queue(Protocol(handshake, 0, extensions));
+        handshakeValid();
+        flush();
+    }
+
+private:
+    void writeMain(const char* data, size_t size) override
+    {
+        parse(data, size);
+    }
+
+    void writeSender(const char* data, size_t size) override
+    {
+        parse(data, size);
+    }
+
+    void readMain(char* data, size_t size) override
+    {
+        if(readOffset == input.size()) {
+            input.clear();
+            readOffset = 0;
+            queue(script[next]);
+            next = (next + 1) % script.size();
+        }
+        memcpy(data, input.data() + readOffset, size);
+        readOffset += size;
+    }
+
+    void queue(const Protocol message)
+    {
+        input.insert(input.end(), (const char*)&message, (const char*)&message + sizeof(Protocol));
+    }
+
+    // Records of a batch follow its header directly, so frames are parsed as a flat stream
+    void parse(const char* data, size_t size)
+    {
+        while(size > 0) {
+            if(payload > 0) {
+                size_t skipped = std::min<size_t>(payload, size);
+                payload -= skipped;
+                data += skipped;
+                size -= skipped;
+                continue;
+            }
+            Protocol message;
+            memcpy(&message, data, sizeof(Protocol));
+            data += sizeof(Protocol);
+            size -= sizeof(Protocol);
+            switch(message.actionId) {
+                case logMessage:
+                    payload = message.addr;
+                    break;
+                case getByte:
+                case getWord:
+                case getDoubleWord:
+                    queue(Protocol(writeRequest, message.addr, 0));
+                    break;
+                case getBlock:
+                    for(uint64_t offset = 0; offset < message.value; offset += BLOCK_DATA_SIZE)
+                        queue(Protocol(blockData, 0, 0));
+                    break;
+            }
+        }
+    }
+
+    std::vector<Protocol> script;
+    size_t next;
+    std::vector<char> input;
+    size_t readOffset;
+    uint64_t payload;
+};
+
+// Handles `requests` requests of `script` to warm the agent up and counts the allocations
+// in as many following ones
+template<typename Bus>
+static void checkAllocations(const char* bus, std::function<Bus*()> create, std::vector<Protocol> script, uint64_t requests)
+{
+    const char* channels[] = { "stream", "stream+" };
+    uint64_t extensions[] = { 0, AGENT_EXTENSIONS };
+    for(int i = 0; i < 2; i++) {
+        ReplayChannel channel(script, extensions[i]);
+        BenchmarkAgent agent(create(), &channel);
+        Protocol request;
+        for(int counted = 0; counted < 2; counted++) {
+            allocations = 0;
+            countAllocations = counted;
+            for(uint64_t j = 0; j < requests; j++) {
+                agent.receive(&request);
+                agent.handleRequest(&request);
+            }
+            countAllocations = false;
+        }
+        printf("%-20s %-10s %14.3f%s\n", bus, channels[i], (double)allocations / requests, allocations == 0 ? "" : "  INVALID");
+        failed |= allocations != 0;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t transactions = argc > 1 ? strtoull(argv[1], nullptr, 0) : 200000;
+    uint64_t cycles = argc > 2 ? strtoull(argv[2], nullptr, 0) : 2000000;
+
+    printf("%-20s %-10s %14s %14s %12s\n", "bus", "channel", "transactions/s", "cycles/s", "messages/tx");
+
+    forEachChannel("APB3", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        ApbModel model;
+        APB3* bus = new APB3();
+        model.bind(bus);
+        return runTarget(bus, model, channel, renode, transactions);
+    });
+    forEachChannel("AxiLite", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        AxiLiteModel model;
+        AxiLite* bus = new AxiLite();
+        model.bind(bus);
+        return runTarget(bus, model, channel, renode, transactions);
+    });
+    forEachChannel("Axi", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        AxiModel model;
+        Axi* bus = new Axi(32, 32);
+        model.bind(bus);
+        return runTarget(bus, model, channel, renode, transactions);
+    });
+    forEachChannel("Wishbone", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        WishboneModel model;
+        Wishbone* bus = new Wishbone();
+        model.bind(bus, false);
+        return runTarget(bus, model, channel, renode, transactions);
+    });
+    forEachChannel("Wishbone pipelined", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        WishboneModel model;
+        Wishbone* bus = new Wishbone();
+        model.bind(bus, true);
+        return runTarget(bus, model, channel, renode, transactions);
+    });
+    forEachChannel("WishboneInitiator", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        WishboneInitiatorModel model;
+        WishboneInitiator<uint32_t, uint32_t>* bus = new WishboneInitiator<uint32_t, uint32_t>();
+        model.bind(bus);
+        return runInitiator(bus, model, channel, renode, cycles);
+    });
+    forEachChannel("AxiSlave", [&](auto& channel, LoopbackCommunicationChannel& renode) {
+        AxiInitiatorModel model;
+        AxiSlave* bus = new AxiSlave(32, 32);
+        model.bind(bus);
+        return runInitiator(bus, model, channel, renode, cycles);
+    });
+    // The CFU is called by Renode directly, without the agent and the channel
+    report("Cfu", "-", runCfu(transactions));
+
+    printf("\n%-10s %14s %14s\n", "channel", "push [ns]", "round trip [ns]");
+    {
+        LoopbackCommunicationChannel renode;
+        runChannel("loopback", renode, renode, transactions);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        NativeLoopbackChannel channel(renode);
+        runChannel("native", channel, renode, transactions);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, 0);
+        runChannel("stream", channel, renode, transactions);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        runChannel("stream+", channel, renode, transactions);
+    }
+#ifdef __linux__
+    {
+        LoopbackCommunicationChannel renode;
+        ShmLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        runChannel("shm", channel, renode, transactions);
+    }
+#endif
+
+    printf("\n%-10s %s\n", "channel", "behavior");
+    {
+        LoopbackCommunicationChannel renode;
+        checkBehavior("loopback", renode, renode);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        NativeLoopbackChannel channel(renode);
+        checkBehavior("native", channel, renode);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, 0);
+        checkBehavior("stream", channel, renode);
+    }
+    {
+        LoopbackCommunicationChannel renode;
+        StreamLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        checkBehavior("stream+", channel, renode);
+    }
+#ifdef __linux__
+    {
+        LoopbackCommunicationChannel renode;
+        ShmLoopbackChannel channel(renode, AGENT_EXTENSIONS);
+        checkBehavior("shm", channel, renode);
+    }
+#endif
+
+    printf("\n%-20s %-10s %14s\n", "bus", "channel", "allocations/request");
+    uint64_t requests = std::max<uint64_t>(transactions / 10, 1000);
+    std::vector<Protocol> targetScript = { Protocol(writeRequestDoubleWord, 4, 1), Protocol(readRequestDoubleWord, 4, 0) };
+    std::vector<Protocol> initiatorScript = { Protocol(tickClock, 0, 100) };
+    {
+        ApbModel model;
+        checkAllocations<APB3>("APB3", [&]() { APB3* bus = new APB3(); model.bind(bus); return bus; }, targetScript, requests);
+    }
+    {
+        AxiLiteModel model;
+        checkAllocations<AxiLite>("AxiLite", [&]() { AxiLite* bus = new AxiLite(); model.bind(bus); return bus; }, targetScript, requests);
+    }
+    {
+        AxiModel model;
+        checkAllocations<Axi>("Axi", [&]() { Axi* bus = new Axi(32, 32); model.bind(bus); return bus; }, targetScript, requests);
+    }
+    {
+        WishboneModel model;
+        checkAllocations<Wishbone>("Wishbone", [&]() { Wishbone* bus = new Wishbone(); model.bind(bus, true); return bus; }, targetScript, requests);
+    }
+    {
+        WishboneInitiatorModel model;
+        checkAllocations<WishboneInitiator<uint32_t, uint32_t>>("WishboneInitiator", [&]() {
+            auto bus = new WishboneInitiator<uint32_t, uint32_t>();
+            model.bind(bus);
+            return bus;
+        }, initiatorScript, requests);
+    }
+    {
+        AxiInitiatorModel model;
+        checkAllocations<AxiSlave>("AxiSlave", [&]() { AxiSlave* bus = new AxiSlave(32, 32); model.bind(bus); return bus; }, initiatorScript, requests);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,509 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+// Trivial models standing in for verilated ones: every model holds the signals
+// expected by one of the buses, reacts to them on the rising clock edge and counts
+// the cycles simulated. Targets are small memories, initiators issue transactions
+// back to back and count the completed ones.
+//
+#ifndef MOCK_MODELS_H
+#define MOCK_MODELS_H
+
+#include "src/buses/apb3.h"
+#include "src/buses/axi.h"
+#include "src/buses/axi-slave.h"
+#include "src/buses/axilite.h"
+#include "src/buses/cfu.h"
+#include "src/buses/wishbone.h"
+#include "src/buses/wishbone-initiator.h"
+
+#define MOCK_MEMORY_WORDS 1024
+
+// Buses evaluate models through a plain function pointer, so every model type
+// has a single instance bound to the bus at a time
+template<typename Model>
+struct ModelEvaluator
+{
+    static void evaluate()
+    {
+        model->eval();
+    }
+
+    static Model* model;
+};
+
+template<typename Model>
+Model* ModelEvaluator<Model>::model = nullptr;
+
+struct MockModel
+{
+    bool risingEdge(uint8_t clk)
+    {
+        bool edge = clk && !previousClk;
+        previousClk = clk;
+        if(edge)
+            cycles++;
+        return edge;
+    }
+
+    uint32_t& word(uint64_t addr)
+    {
+        return memory[(addr / 4) % MOCK_MEMORY_WORDS];
+    }
+
+    uint8_t previousClk = 0;
+    uint64_t cycles = 0;
+    uint64_t transactions = 0;
+    uint32_t memory[MOCK_MEMORY_WORDS] = {};
+};
+
+struct ApbModel : public MockModel
+{
+    void bind(APB3* bus)
+    {
+        ModelEvaluator<ApbModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<ApbModel>::evaluate;
+        bus->pclk = &pclk;
+        bus->prst = &prst;
+        bus->paddr = &paddr;
+        bus->psel = &psel;
+        bus->penable = &penable;
+        bus->pwrite = &pwrite;
+        bus->pwdata = &pwdata;
+        bus->pready = &pready;
+        bus->prdata = &prdata;
+        bus->pslverr = &pslverr;
+    }
+
+    void eval()
+    {
+        if(!risingEdge(pclk))
+            return;
+        if(psel && penable && pready) {
+            if(pwrite)
+                word(paddr) = pwdata;
+            pready = 0;
+        }
+        else {
+            pready = psel;
+        }
+        prdata = word(paddr);
+    }
+
+    uint8_t pclk = 0, prst = 0, paddr = 0, psel = 0, penable = 0, pwrite = 0, pready = 0, pslverr = 0;
+    uint32_t pwdata = 0, prdata = 0;
+};
+
+struct AxiLiteModel : public MockModel
+{
+    void bind(AxiLite* bus)
+    {
+        ModelEvaluator<AxiLiteModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<AxiLiteModel>::evaluate;
+        bus->clk = &clk;
+        bus->rst = &rst;
+        bus->awvalid = &awvalid;
+        bus->awready = &awready;
+        bus->awprot = &awprot;
+        bus->wstrb = &wstrb;
+        bus->wvalid = &wvalid;
+        bus->wready = &wready;
+        bus->bresp = &bresp;
+        bus->bvalid = &bvalid;
+        bus->bready = &bready;
+        bus->arvalid = &arvalid;
+        bus->arready = &arready;
+        bus->arprot = &arprot;
+        bus->rresp = &rresp;
+        bus->rvalid = &rvalid;
+        bus->rready = &rready;
+        bus->awaddr = &awaddr;
+        bus->wdata = &wdata;
+        bus->araddr = &araddr;
+        bus->rdata = &rdata;
+    }
+
+    void eval()
+    {
+        if(!risingEdge(clk))
+            return;
+        if(awvalid && awready) {
+            writeAddress = awaddr;
+            addressLatched = true;
+        }
+        if(wvalid && wready) {
+            writeData = wdata;
+            dataLatched = true;
+        }
+        if(bvalid && bready)
+            bvalid = 0;
+        if(addressLatched && dataLatched) {
+            word(writeAddress) = writeData;
+            addressLatched = dataLatched = false;
+            bvalid = 1;
+        }
+        if(rvalid && rready)
+            rvalid = 0;
+        if(arvalid && arready) {
+            rdata = word(araddr);
+            rvalid = 1;
+        }
+    }
+
+    uint8_t clk = 0, rst = 0, awvalid = 0, awready = 1, awprot = 0, wstrb = 0, wvalid = 0, wready = 1;
+    uint8_t bresp = 0, bvalid = 0, bready = 0, arvalid = 0, arready = 1, arprot = 0, rresp = 0, rvalid = 0, rready = 0;
+    uint64_t awaddr = 0, wdata = 0, araddr = 0, rdata = 0;
+    uint64_t writeAddress = 0, writeData = 0;
+    bool addressLatched = false, dataLatched = false;
+};
+
+// Signals of a 32-bit AXI4 interface, shared by the target and the initiator models
+struct AxiSignals : public MockModel
+{
+    void bind(BaseAxi* bus)
+    {
+        bus->aclk = &aclk;
+        bus->aresetn = &aresetn;
+        bus->awid = &awid;
+        bus->awaddr = &awaddr;
+        bus->awlen = &awlen;
+        bus->awsize = &awsize;
+        bus->awburst = &awburst;
+        bus->awlock = &awlock;
+        bus->awcache = &awcache;
+        bus->awprot = &awprot;
+        bus->awqos = &awqos;
+        bus->awregion = &awregion;
+        bus->awuser = &awuser;
+        bus->awvalid = &awvalid;
+        bus->awready = &awready;
+        bus->wdata = &wdata;
+        bus->wstrb = &wstrb;
+        bus->wlast = &wlast;
+        bus->wuser = &wuser;
+        bus->wvalid = &wvalid;
+        bus->wready = &wready;
+        bus->bid = &bid;
+        bus->bresp = &bresp;
+        bus->buser = &buser;
+        bus->bvalid = &bvalid;
+        bus->bready = &bready;
+        bus->arid = &arid;
+        bus->araddr = &araddr;
+        bus->arlen = &arlen;
+        bus->arsize = &arsize;
+        bus->arburst = &arburst;
+        bus->arlock = &arlock;
+        bus->arcache = &arcache;
+        bus->arprot = &arprot;
+        bus->arqos = &arqos;
+        bus->arregion = &arregion;
+        bus->aruser = &aruser;
+        bus->arvalid = &arvalid;
+        bus->arready = &arready;
+        bus->rid = &rid;
+        bus->rdata = &rdata;
+        bus->rresp = &rresp;
+        bus->rlast = &rlast;
+        bus->ruser = &ruser;
+        bus->rvalid = &rvalid;
+        bus->rready = &rready;
+    }
+
+    uint8_t aclk = 0, aresetn = 0;
+    uint8_t awid = 0, awlen = 0, awsize = 0, awburst = 0, awlock = 0, awcache = 0, awprot = 0, awqos = 0, awregion = 0, awuser = 0, awvalid = 0, awready = 0;
+    uint8_t wstrb = 0, wlast = 0, wuser = 0, wvalid = 0, wready = 0;
+    uint8_t bid = 0, bresp = 0, buser = 0, bvalid = 0, bready = 0;
+    uint8_t arid = 0, arlen = 0, arsize = 0, arburst = 0, arlock = 0, arcache = 0, arprot = 0, arqos = 0, arregion = 0, aruser = 0, arvalid = 0, arready = 0;
+    uint8_t rid = 0, rresp = 0, rlast = 0, ruser = 0, rvalid = 0, rready = 0;
+    uint32_t awaddr = 0, araddr = 0, wdata = 0, rdata = 0;
+};
+
+// AXI4 target handling one read and one write burst at a time (INCR bursts only)
+struct AxiModel : public AxiSignals
+{
+    void bind(Axi* bus)
+    {
+        ModelEvaluator<AxiModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<AxiModel>::evaluate;
+        AxiSignals::bind(bus);
+    }
+
+    void eval()
+    {
+        if(!risingEdge(aclk))
+            return;
+
+        switch(writeState) {
+            case AddressPhase:
+                if(awvalid && awready) {
+                    writeAddress = awaddr;
+                    writeBeats = awlen + 1;
+                    awready = 0;
+                    wready = 1;
+                    writeState = DataPhase;
+                }
+                else {
+                    awready = 1;
+                }
+                break;
+            case DataPhase:
+                if(wvalid && wready) {
+                    word(writeAddress) = wdata;
+                    writeAddress += 4;
+                    if(--writeBeats == 0) {
+                        wready = 0;
+                        bvalid = 1;
+                        writeState = ResponsePhase;
+                    }
+                }
+                break;
+            case ResponsePhase:
+                if(bvalid && bready) {
+                    bvalid = 0;
+                    writeState = AddressPhase;
+                }
+                break;
+        }
+
+        switch(readState) {
+            case AddressPhase:
+                if(arvalid && arready) {
+                    readAddress = araddr;
+                    readBeats = arlen + 1;
+                    arready = 0;
+                    rvalid = 1;
+                    rdata = word(readAddress);
+                    rlast = readBeats == 1;
+                    readState = DataPhase;
+                }
+                else {
+                    arready = 1;
+                }
+                break;
+            default:
+                if(rvalid && rready) {
+                    if(--readBeats == 0) {
+                        rvalid = 0;
+                        readState = AddressPhase;
+                    }
+                    else {
+                        readAddress += 4;
+                        rdata = word(readAddress);
+                        rlast = readBeats == 1;
+                    }
+                }
+                break;
+        }
+    }
+
+    enum Phase { AddressPhase, DataPhase, ResponsePhase };
+
+    Phase writeState = AddressPhase, readState = AddressPhase;
+    uint64_t writeAddress = 0, readAddress = 0;
+    uint32_t writeBeats = 0, readBeats = 0;
+};
+
+// AXI4 initiator issuing INCR bursts of `burstLength` beats, reads and writes in parallel.
+// Every completed burst is a transaction.
+struct AxiInitiatorModel : public AxiSignals
+{
+    void bind(AxiSlave* bus)
+    {
+        ModelEvaluator<AxiInitiatorModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<AxiInitiatorModel>::evaluate;
+        AxiSignals::bind(bus);
+        drive();
+    }
+
+    void eval()
+    {
+        if(!risingEdge(aclk))
+            return;
+        if(rvalid && rready && rlast)
+            transactions++;
+        if(bvalid && bready)
+            transactions++;
+        if(arvalid && arready)
+            readAddress = (readAddress + burstLength * 4) % (MOCK_MEMORY_WORDS * 4);
+        if(awvalid && awready)
+            writeAddress = (writeAddress + burstLength * 4) % (MOCK_MEMORY_WORDS * 4);
+        if(wvalid && wready)
+            writeBeat = (writeBeat + 1) % burstLength;
+        drive();
+    }
+
+    void drive()
+    {
+        arvalid = 1;
+        araddr = readAddress;
+        arlen = burstLength - 1;
+        arsize = 2;
+        arburst = (uint8_t)AxiBurstType::INCR;
+        awvalid = 1;
+        awaddr = writeAddress;
+        awlen = burstLength - 1;
+        awsize = 2;
+        awburst = (uint8_t)AxiBurstType::INCR;
+        wvalid = 1;
+        wdata = cycles;
+        wstrb = 0xF;
+        wlast = writeBeat == burstLength - 1;
+        rready = 1;
+        bready = 1;
+    }
+
+    uint32_t burstLength = 4;
+    uint32_t writeBeat = 0;
+    uint64_t readAddress = 0, writeAddress = 0x1000;
+};
+
+// Wishbone target answering in the cycle after a request, classic or pipelined
+struct WishboneModel : public MockModel
+{
+    void bind(Wishbone* bus, bool pipelined)
+    {
+        ModelEvaluator<WishboneModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<WishboneModel>::evaluate;
+        bus->wb_clk = &clk;
+        bus->wb_rst = &rst;
+        bus->wb_addr = &addr;
+        bus->wb_rd_dat = &rdData;
+        bus->wb_wr_dat = &wrData;
+        bus->wb_we = &we;
+        bus->wb_sel = &sel;
+        bus->wb_stb = &stb;
+        bus->wb_ack = &ack;
+        bus->wb_cyc = &cyc;
+        bus->wb_stall = &stall;
+        bus->granularity = 1;
+        bus->addr_lines = 30;
+        bus->pipelined = pipelined;
+        this->pipelined = pipelined;
+    }
+
+    void eval()
+    {
+        if(!risingEdge(clk))
+            return;
+        if(pipelined) {
+            ack = pending;
+            if(pending && !pendingWrite)
+                rdData = word(pendingAddress * 4);
+            pending = cyc && stb;
+            if(pending) {
+                pendingAddress = addr;
+                pendingWrite = we;
+                if(we)
+                    word(addr * 4) = wrData;
+            }
+        }
+        else if(cyc && stb && !ack) {
+            if(we)
+                word(addr * 4) = wrData;
+            else
+                rdData = word(addr * 4);
+            ack = 1;
+        }
+        else {
+            ack = 0;
+        }
+    }
+
+    uint8_t clk = 0, rst = 0, we = 0, sel = 0, stb = 0, ack = 0, cyc = 0, stall = 0;
+    uint64_t addr = 0, rdData = 0, wrData = 0;
+    uint64_t pendingAddress = 0;
+    bool pending = false, pendingWrite = false, pipelined = false;
+};
+
+// 32-bit Wishbone initiator alternating classic reads and writes
+struct WishboneInitiatorModel : public MockModel
+{
+    void bind(WishboneInitiator<uint32_t, uint32_t>* bus)
+    {
+        ModelEvaluator<WishboneInitiatorModel>::model = this;
+        bus->evaluateModel = ModelEvaluator<WishboneInitiatorModel>::evaluate;
+        bus->wb_clk = &clk;
+        bus->wb_rst = &rst;
+        bus->wb_addr = &addr;
+        bus->wb_rd_dat = &rdData;
+        bus->wb_wr_dat = &wrData;
+        bus->wb_we = &we;
+        bus->wb_sel = &sel;
+        bus->wb_stb = &stb;
+        bus->wb_ack = &ack;
+        bus->wb_cyc = &cyc;
+        bus->wb_stall = &stall;
+        bus->granularity = 1;
+        bus->addr_lines = 32;
+        drive();
+    }
+
+    void eval()
+    {
+        if(!risingEdge(clk))
+            return;
+        if(ack) {
+            transactions++;
+            address = (address + 4) % (MOCK_MEMORY_WORDS * 4);
+        }
+        drive();
+    }
+
+    void drive()
+    {
+        cyc = 1;
+        stb = 1;
+        we = transactions % 2;
+        sel = 0xF;
+        addr = address;
+        wrData = transactions;
+    }
+
+    uint8_t clk = 0, rst = 0, we = 0, sel = 0, stb = 0, ack = 0, cyc = 0, stall = 0;
+    uint32_t addr = 0, rdData = 0, wrData = 0;
+    uint64_t address = 0;
+};
+
+// CFU returning the sum of its operands in the cycle after the request
+struct CfuModel : public MockModel
+{
+    void bind(Cfu* cfu)
+    {
+        ModelEvaluator<CfuModel>::model = this;
+        cfu->evaluateModel = ModelEvaluator<CfuModel>::evaluate;
+        cfu->req_valid = &reqValid;
+        cfu->req_ready = &reqReady;
+        cfu->req_func_id = &reqFuncId;
+        cfu->req_data0 = &reqData0;
+        cfu->req_data1 = &reqData1;
+        cfu->resp_valid = &respValid;
+        cfu->resp_ready = &respReady;
+        cfu->resp_ok = &respOk;
+        cfu->resp_data = &respData;
+        cfu->rst = &rst;
+        cfu->clk = &clk;
+        cfu->tickCounter = 0;
+    }
+
+    void eval()
+    {
+        if(!risingEdge(clk))
+            return;
+        if(respValid && respReady)
+            respValid = 0;
+        if(reqValid && reqReady && !respValid) {
+            respData = reqData0 + reqData1;
+            respValid = 1;
+        }
+    }
+
+    uint8_t reqValid = 0, reqReady = 1, respValid = 0, respReady = 0, respOk = 1, rst = 0, clk = 0;
+    uint16_t reqFuncId = 0;
+    uint32_t reqData0 = 0, reqData1 = 0, respData = 0;
+};
+
+#endif
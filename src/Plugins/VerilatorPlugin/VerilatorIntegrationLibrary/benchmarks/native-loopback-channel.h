@@ -0,0 +1,61 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef NATIVE_LOOPBACK_CHANNEL_H
+#define NATIVE_LOOPBACK_CHANNEL_H
+
+#include "src/renode_bus.h"
+
+// Set by EXTERNAL_AS of renode-imports-stub.h
+extern action_intptr handleMainMessageImport;
+extern action_intptr handleSenderMessageImport;
+extern action_intptr receiveImport;
+
+// Messages go through the imports of NativeCommunicationChannel, as in the native mode,
+// with the handlers Renode would export stubbed to pass them to a LoopbackCommunicationChannel
+// playing the part of Renode. Only one channel can exist at a time.
+class NativeLoopbackChannel : public NativeCommunicationChannel
+{
+public:
+    NativeLoopbackChannel(LoopbackCommunicationChannel& renode)
+        : renode(renode)
+    {
+        current = &renode;
+        handleMainMessageImport = [](void* message) {
+            current->sendMain(*(Protocol*)message);
+        };
+        // Logs are sent as the text followed by the level, see NativeCommunicationChannel::log
+        handleSenderMessageImport = [](void* message) {
+            Protocol* received = (Protocol*)message;
+            if(received->actionId != logMessage)
+                current->sendSender(*received);
+            else if(received->addr == 0)
+                current->log(received->value, nullptr);
+        };
+        receiveImport = [](void* message) {
+            current->receive((Protocol*)message);
+        };
+    }
+
+    ~NativeLoopbackChannel()
+    {
+        current = nullptr;
+    }
+
+    void request(const Protocol message)
+    {
+        renode.request(message);
+    }
+
+private:
+    LoopbackCommunicationChannel& renode;
+
+    static LoopbackCommunicationChannel* current;
+};
+
+LoopbackCommunicationChannel* NativeLoopbackChannel::current = nullptr;
+
+#endif
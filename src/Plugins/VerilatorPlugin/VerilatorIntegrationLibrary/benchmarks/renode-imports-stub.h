@@ -0,0 +1,21 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef RENODE_IMPORTS_STUB_H
+#define RENODE_IMPORTS_STUB_H
+
+#include <stdint.h>
+
+// Stands in for renode_imports.h of the Renode tree. Every import `LOCAL_NAME` calls
+// the handler set in `LOCAL_NAME##Import` by the benchmark, where Renode would attach
+// its exported method `IMPORTED_NAME`.
+typedef void (*action_intptr)(void* ptr);
+
+#define EXTERNAL_AS(TYPE, IMPORTED_NAME, LOCAL_NAME) \
+    TYPE LOCAL_NAME##Import = nullptr; \
+    void LOCAL_NAME(void* ptr) { LOCAL_NAME##Import(ptr); }
+
+#endif
@@ -0,0 +1,233 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef SHM_LOOPBACK_CHANNEL_H
+#define SHM_LOOPBACK_CHANNEL_H
+
+#ifdef __linux__
+#include <algorithm>
+#include <climits>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "src/renode_bus.h"
+
+#define SHM_LOOPBACK_RING_SIZE (1 << 20)
+
+// Messages go through the rings of ShmCommunicationChannel, as over shared memory, with
+// a thread playing the part of Renode: it passes everything the agent writes to a
+// LoopbackCommunicationChannel and writes its replies and the queued requests back,
+// so both sides run concurrently. `extensions` are requested in the handshake.
+// `flush` returns once the thread has handled everything sent by the agent so far.
+class ShmLoopbackChannel : public ShmCommunicationChannel
+{
+public:
+    ShmLoopbackChannel(LoopbackCommunicationChannel& renode, uint64_t extensions)
+        : renode(renode), written(0), stopped(false)
+    {
+        static int segments = 0;
+        std::string name = "/vil-bus-throughput-" + std::to_string(getpid()) + "-" + std::to_string(segments++);
+        size_t headerSize = (sizeof(ShmSegmentHeader) + 63) & ~(size_t)63;
+        mappingSize = headerSize + 3 * SHM_LOOPBACK_RING_SIZE;
+
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if(fd < 0)
+            throw "Unable to create the shared memory segment";
+        void* mapping = ftruncate(fd, mappingSize) == 0
+            ? mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+            : MAP_FAILED;
+        close(fd);
+        if(mapping == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw "Unable to map the shared memory segment";
+        }
+
+        // The segment is zeroed, only the layout has to be filled in
+        segment = (ShmSegmentHeader*)mapping;
+        segment->magic = SHM_CHANNEL_MAGIC;
+        segment->version = SHM_CHANNEL_VERSION;
+        uint32_t offset = headerSize;
+        for(ShmRing* ring : { &segment->requests, &segment->responses, &segment->sender }) {
+            ring->offset = offset;
+            ring->size = SHM_LOOPBACK_RING_SIZE;
+            offset += SHM_LOOPBACK_RING_SIZE;
+        }
+
+        request(Protocol(handshake, 0, extensions));
+        renodeThread = std::thread(&ShmLoopbackChannel::run, this);
+        connect(name.c_str());
+        shm_unlink(name.c_str());
+        flush();
+        renode.responses.clear();
+        renode.messages = 0;
+    }
+
+    ~ShmLoopbackChannel()
+    {
+        stopped = true;
+        renodeThread.join();
+        munmap(segment, mappingSize);
+    }
+
+    // Requests are never batched by Renode
+    void request(const Protocol message)
+    {
+        std::lock_guard<std::mutex> lock(requestsLock);
+        requests.insert(requests.end(), (const char*)&message, (const char*)&message + sizeof(Protocol));
+    }
+
+    void flush() override
+    {
+        ShmCommunicationChannel::flush();
+        for(ShmRing* ring : { &segment->responses, &segment->sender }) {
+            while(ring->tail.load(std::memory_order_acquire) != ring->head.load(std::memory_order_relaxed))
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Stream
+    {
+        std::vector<char> data;
+        uint64_t payload = 0;
+    };
+
+    // Renode's side, the agent's side only waits on the rings while it's blocked
+    void run()
+    {
+        Stream main;
+        Stream sender;
+        while(!stopped) {
+            bool received = consume(segment->responses, main, true);
+            received |= consume(segment->sender, sender, false);
+            {
+                std::lock_guard<std::mutex> lock(requestsLock);
+                outgoing.insert(outgoing.end(), requests.begin(), requests.end());
+                requests.clear();
+            }
+            written += write(segment->requests, outgoing.data() + written, outgoing.size() - written);
+            if(written == outgoing.size()) {
+                outgoing.clear();
+                written = 0;
+            }
+            if(!received)
+                std::this_thread::yield();
+        }
+    }
+
+    // Records of a batch follow its header directly, so frames are parsed as a flat stream.
+    // The ring is released only after its records are handled, which `flush` waits for.
+    bool consume(ShmRing& ring, Stream& stream, bool isMain)
+    {
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        if(head == tail)
+            return false;
+
+        const char* buffer = (const char*)segment + ring.offset;
+        size_t position = tail & (ring.size - 1);
+        size_t chunk = std::min<uint64_t>(head - tail, ring.size - position);
+        stream.data.insert(stream.data.end(), buffer + position, buffer + position + chunk);
+        stream.data.insert(stream.data.end(), buffer, buffer + (head - tail - chunk));
+
+        size_t offset = 0;
+        while(offset < stream.data.size()) {
+            if(stream.payload > 0) {
+                size_t skipped = std::min<uint64_t>(stream.payload, stream.data.size() - offset);
+                stream.payload -= skipped;
+                offset += skipped;
+                continue;
+            }
+            if(stream.data.size() - offset < sizeof(Protocol))
+                break;
+            Protocol message;
+            memcpy(&message, stream.data.data() + offset, sizeof(Protocol));
+            offset += sizeof(Protocol);
+            handle(message, stream, isMain);
+        }
+        stream.data.erase(stream.data.begin(), stream.data.begin() + offset);
+
+        ring.tail.store(head, std::memory_order_release);
+        notify(ring);
+        return true;
+    }
+
+    void handle(const Protocol message, Stream& stream, bool isMain)
+    {
+        if(message.actionId == batch)
+            return;
+        if(message.actionId == logMessage) {
+            stream.payload = message.addr;
+            renode.log(message.value, nullptr);
+        }
+        else if(isMain) {
+            renode.sendMain(message);
+        }
+        else {
+            renode.sendSender(message);
+            // The loopback queues its replies to the reads of the agent, nothing else is requested from it
+            uint64_t replies = 0;
+            if(message.actionId == getByte || message.actionId == getWord || message.actionId == getDoubleWord)
+                replies = 1;
+            else if(message.actionId == getBlock)
+                replies = (message.value + BLOCK_DATA_SIZE - 1) / BLOCK_DATA_SIZE;
+            for(; replies > 0; replies--) {
+                Protocol reply;
+                renode.receive(&reply);
+                outgoing.insert(outgoing.end(), (const char*)&reply, (const char*)&reply + sizeof(Protocol));
+            }
+        }
+    }
+
+    // Writes as much as fits, so that the thread never waits for the agent
+    size_t write(ShmRing& ring, const char* data, size_t size)
+    {
+        char* buffer = (char*)segment + ring.offset;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        size_t total = 0;
+
+        while(size > 0) {
+            uint64_t space = ring.size - (head - ring.tail.load(std::memory_order_acquire));
+            if(space == 0)
+                break;
+            size_t position = head & (ring.size - 1);
+            size_t chunk = std::min<size_t>({ size, space, ring.size - position });
+            memcpy(buffer + position, data, chunk);
+            data += chunk;
+            size -= chunk;
+            head += chunk;
+            total += chunk;
+        }
+        if(total > 0) {
+            ring.head.store(head, std::memory_order_release);
+            notify(ring);
+        }
+        return total;
+    }
+
+    static void notify(ShmRing& ring)
+    {
+        ring.sequence++;
+        if(ring.waiters.load() > 0)
+            syscall(SYS_futex, (uint32_t*)&ring.sequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    LoopbackCommunicationChannel& renode;
+    ShmSegmentHeader* segment;
+    size_t mappingSize;
+    std::vector<char> outgoing;
+    size_t written;
+    std::mutex requestsLock;
+    std::vector<char> requests;
+    std::atomic<bool> stopped;
+    std::thread renodeThread;
+};
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef STREAM_LOOPBACK_CHANNEL_H
+#define STREAM_LOOPBACK_CHANNEL_H
+
+#include <algorithm>
+#include "src/renode_bus.h"
+
+// Messages go through the framing of StreamCommunicationChannel, as over the sockets,
+// but the bytes are exchanged in memory with a LoopbackCommunicationChannel playing
+// the part of Renode. `extensions` are requested in the handshake.
+class StreamLoopbackChannel : public StreamCommunicationChannel
+{
+public:
+    StreamLoopbackChannel(LoopbackCommunicationChannel& renode, uint64_t extensions)
+        : renode(renode), payload(0), readOffset(0)
+    {
+        renode.request(Protocol(handshake, 0, extensions));
+        handshakeValid();
+        flush();
+        renode.responses.clear();
+        renode.messages = 0;
+    }
+
+    // Requests are never batched by Renode
+    void request(const Protocol message)
+    {
+        renode.request(message);
+    }
+
+private:
+    void writeMain(const char* data, size_t size) override
+    {
+        parse(data, size, true);
+    }
+
+    void writeSender(const char* data, size_t size) override
+    {
+        parse(data, size, false);
+    }
+
+    void readMain(char* data, size_t size) override
+    {
+        while(input.size() - readOffset < size) {
+            Protocol message;
+            renode.receive(&message);
+            input.insert(input.end(), (const char*)&message, (const char*)&message + sizeof(Protocol));
+        }
+        memcpy(data, input.data() + readOffset, size);
+        readOffset += size;
+        if(readOffset == input.size()) {
+            input.clear();
+            readOffset = 0;
+        }
+    }
+
+    // Records of a batch follow its header directly, so frames are parsed as a flat stream
+    void parse(const char* data, size_t size, bool isMain)
+    {
+        while(size > 0) {
+            if(payload > 0) {
+                size_t skipped = std::min<size_t>(payload, size);
+                payload -= skipped;
+                data += skipped;
+                size -= skipped;
+                continue;
+            }
+            Protocol message;
+            memcpy(&message, data, sizeof(Protocol));
+            data += sizeof(Protocol);
+            size -= sizeof(Protocol);
+            if(message.actionId == batch)
+                continue;
+            if(message.actionId == logMessage) {
+                payload = message.addr;
+                renode.log(message.value, nullptr);
+            }
+            else if(isMain) {
+                renode.sendMain(message);
+            }
+            else {
+                renode.sendSender(message);
+            }
+        }
+    }
+
+    LoopbackCommunicationChannel& renode;
+    std::vector<char> input;
+    uint64_t payload;
+    size_t readOffset;
+};
+
+#endif
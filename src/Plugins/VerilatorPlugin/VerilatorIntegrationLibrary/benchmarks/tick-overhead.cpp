@@ -0,0 +1,78 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+// Compares the per-cycle cost of the virtual `BaseBus::tick` path, which
+// evaluates the model through the `evaluateModel` pointer, with FastTickBus.
+//
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include "src/buses/axilite.h"
+#include "src/buses/fast-tick.h"
+
+// Stands in for a verilated model with a trivial `eval`,
+// so that the measurement is dominated by the tick overhead.
+struct CounterModel
+{
+    uint8_t clk = 0;
+    uint8_t prevClk = 0;
+    uint64_t counter = 0;
+
+    void eval()
+    {
+        if(clk && !prevClk) {
+            counter++;
+        }
+        prevClk = clk;
+    }
+};
+
+struct CounterClock
+{
+    static uint8_t& signal(CounterModel& model) { return model.clk; }
+};
+
+static CounterModel* model;
+
+static void evaluateModel()
+{
+    model->eval();
+}
+
+static double measure(BaseBus* bus, uint64_t cycles)
+{
+    auto start = std::chrono::steady_clock::now();
+    bus->tick(true, cycles);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / cycles;
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t cycles = argc > 1 ? strtoull(argv[1], nullptr, 0) : 100000000;
+    model = new CounterModel();
+
+    AxiLite* virtualBus = new AxiLite();
+    virtualBus->clk = &model->clk;
+    virtualBus->evaluateModel = evaluateModel;
+
+    FastTickBus<AxiLite, CounterModel, CounterClock>* fastBus = new FastTickBus<AxiLite, CounterModel, CounterClock>(model);
+    fastBus->clk = &model->clk;
+    fastBus->evaluateModel = evaluateModel;
+
+    // Warm up
+    measure(virtualBus, cycles / 10);
+    measure(fastBus, cycles / 10);
+
+    double virtualNs = measure(virtualBus, cycles);
+    double fastNs = measure(fastBus, cycles);
+
+    printf("cycles:       %llu\n", (unsigned long long)cycles);
+    printf("virtual tick: %.3f ns/cycle\n", virtualNs);
+    printf("FastTickBus:  %.3f ns/cycle\n", fastNs);
+    printf("speedup:      %.2fx\n", virtualNs / fastNs);
+    return model->counter == (cycles + cycles / 10) * 2 ? 0 : 1;
+}
@@ -14,6 +14,7 @@ void APB3::tick(bool countEnable, uint64_t steps = 1)
         evaluateModel();
         *pclk = 0;
         evaluateModel();
+        cycleTicked();
     }
 
     if(countEnable) {
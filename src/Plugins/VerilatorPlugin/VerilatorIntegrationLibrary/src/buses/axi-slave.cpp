@@ -8,19 +8,19 @@
 #include <cmath>
 #include <cinttypes>
 
-AxiSlave::AxiSlave(uint32_t dataWidth, uint32_t addrWidth) : BaseAxi(dataWidth, addrWidth)
+AxiSlave::AxiSlave(uint32_t dataWidth, uint32_t addrWidth) : BaseAxi(dataWidth, addrWidth),
+    reads(AXI_MAX_OUTSTANDING), writes(AXI_MAX_OUTSTANDING), writeResponses(AXI_MAX_OUTSTANDING)
 {
-    writeState = AxiWriteState::AW;
-    readState = AxiReadState::AR;
-
     arready_new = 0;
     rvalid_new = 0;
     rlast_new = 0;
-    rdata_new = 0;
+    rid_new = 0;
+    memset(rdata_new, 0, sizeof(rdata_new));
 
     awready_new = 0;
     wready_new = 0;
     bvalid_new = 0;
+    bid_new = 0;
 }
 
 void AxiSlave::tick(bool countEnable, uint64_t steps = 1)
@@ -33,6 +33,7 @@ void AxiSlave::tick(bool countEnable, uint64_t steps = 1)
         updateSignals();
         *aclk = 0;
         evaluateModel();
+        cycleTicked();
     }
 
     // Since we can run out of steps during an AXI transaction we must let
@@ -66,7 +67,7 @@ void AxiSlave::clearSignals()
 {
     arready_new = *arready;
     rvalid_new = *rvalid;
-    rdata_new = *rdata;
+    rdata.getBytes(rdata_new, dataBytes);
     awready_new = *awready;
     wready_new = *wready;
     bvalid_new = *bvalid;
@@ -74,7 +75,7 @@ void AxiSlave::clearSignals()
     // Read
     *arready = 0;
     *rvalid = 0;
-    *rdata = 0;
+    rdata.set(0, dataBytes);
     // Write
     *awready = 0;
     *wready  = 0;
@@ -89,11 +90,15 @@ void AxiSlave::updateSignals()
     *arready = arready_new;
     *rvalid  = rvalid_new;
     *rlast   = rlast_new;
-    *rdata   = rdata_new;
+    rdata.setBytes(rdata_new, dataBytes);
+    if(rid != nullptr)
+        *rid = rid_new;
     // Write
     *awready = awready_new;
     *wready  = wready_new;
     *bvalid  = bvalid_new;
+    if(bid != nullptr)
+        *bid = bid_new;
 }
 
 // Sample signals before rising edge in handlers
@@ -102,118 +107,303 @@ void AxiSlave::readWord(uint64_t addr, uint8_t sel = 0)
 {
     sprintf(buffer, "Axi read from: 0x%" PRIX64, addr);
     this->agent->log(0, buffer);
-    rdata_new = this->agent->requestFromAgent(addr);
+    readBeat(addr, rdata_new);
 }
 
-void AxiSlave::readHandler()
+void AxiSlave::readBeat(uint64_t addr, uint8_t* data)
 {
-    switch(readState) {
-        case AxiReadState::AR:
-            arready_new = 1;
-            if(*arready == 1 && *arvalid == 1) {
-                arready_new   = 0;
-
-                readLen       = *arlen;
-                readNumBytes  = pow(2, *arsize);
-                readState     = AxiReadState::R;
-                readBurstType = static_cast<AxiBurstType>(*arburst);
-                readAddr      = uint64_t((*araddr)/readNumBytes) * readNumBytes;
-
-                rlast_new     = (readLen == 0);
-
-                if(readAddr != *araddr)
-                    throw "Unaligned transfers are not supported";
+    fetch(addr, data, dataBytes);
+}
 
-                if(readBurstType != AxiBurstType::INCR)
-                    throw "Unsupported AXI read burst type";
+void AxiSlave::fetch(uint64_t addr, uint8_t* data, uint64_t size)
+{
+    if(this->agent->isMemoryBacked(addr, size)) {
+        this->agent->requestBlockFromAgent(addr, data, size);
+        return;
+    }
 
-                if(readNumBytes != int(dataWidth/8))
-                    throw "Narrow bursts are not supported";
+    // Naturally aligned accesses of up to a double word, so peripherals see the width of the beat
+    uint64_t i = 0;
+    while(i < size) {
+        uint64_t chunk = accessSize(addr + i, size - i);
+        uint64_t value;
+        if(chunk == 4)
+            value = this->agent->requestDoubleWordFromAgent(addr + i);
+        else if(chunk == 2)
+            value = this->agent->requestWordFromAgent(addr + i);
+        else
+            value = this->agent->requestByteFromAgent(addr + i);
+        memcpy(data + i, &value, chunk);
+        i += chunk;
+    }
+}
 
-                this->agent->log(0, "Axi read start");
+uint64_t AxiSlave::accessSize(uint64_t addr, uint64_t size)
+{
+    if(size >= 4 && addr % 4 == 0)
+        return 4;
+    if(size >= 2 && addr % 2 == 0)
+        return 2;
+    return 1;
+}
 
-                readWord(readAddr);
-            }
+void AxiSlave::startTransaction(AxiTransaction& transaction, uint8_t id, uint64_t addr, uint8_t len, uint8_t size, uint8_t burst)
+{
+    transaction.id        = id;
+    transaction.addr      = addr;
+    transaction.len       = len + 1;
+    transaction.numBytes  = 1 << size;
+    transaction.beat      = 0;
+    transaction.burstType = static_cast<AxiBurstType>(burst);
+
+    if(transaction.numBytes > dataBytes)
+        throw "AXI transfer size exceeds the data width";
+
+    uint64_t alignedAddr = addr / transaction.numBytes * transaction.numBytes;
+    switch(transaction.burstType) {
+        case AxiBurstType::FIXED:
+            transaction.regionStart = addr;
+            transaction.regionSize  = alignedAddr + transaction.numBytes - addr;
             break;
-        case AxiReadState::R:
-            rvalid_new = 1;
-
-            if(*rready == 1 && *rvalid == 1) {
-                if(readLen == 0) {
-                    readState = AxiReadState::AR;
-                    rvalid_new = 0;
-                    rlast_new = 0;
-                    this->agent->log(0, "Axi read transfer completed");
-                } else {
-                    readLen--;
-                    readAddr += int(dataWidth/8); // TODO: make data width configurable
-                    readWord(readAddr);
-                    rlast_new = (readLen == 0);
-                }
-            }
+        case AxiBurstType::INCR:
+            transaction.regionStart = addr;
+            transaction.regionSize  = alignedAddr + transaction.len * transaction.numBytes - addr;
             break;
-        default:
-            readState = AxiReadState::AR;
+        case AxiBurstType::WRAP:
+            if(transaction.len != 2 && transaction.len != 4 && transaction.len != 8 && transaction.len != 16)
+                throw "Unsupported AXI wrapping burst length";
+            if(alignedAddr != addr)
+                throw "Unaligned AXI wrapping burst";
+            transaction.regionSize  = transaction.len * transaction.numBytes;
+            transaction.regionStart = addr / transaction.regionSize * transaction.regionSize;
             break;
+        default:
+            throw "Unsupported AXI burst type";
     }
 }
 
+// Address of the beat as defined by the AXI4 specification
+uint64_t AxiSlave::beatAddress(const AxiTransaction& transaction, uint32_t beat)
+{
+    if(transaction.burstType == AxiBurstType::FIXED || beat == 0)
+        return transaction.addr;
+
+    uint64_t addr = transaction.addr / transaction.numBytes * transaction.numBytes + beat * transaction.numBytes;
+    if(transaction.burstType == AxiBurstType::WRAP && addr >= transaction.regionStart + transaction.regionSize)
+        addr -= transaction.regionSize;
+    return addr;
+}
+
+void AxiSlave::startRead()
+{
+    AxiTransaction& transaction = reads.push();
+    try {
+        startTransaction(transaction, arid != nullptr ? *arid : 0, *araddr, *arlen, *arsize, *arburst);
+    }
+    catch(const char*) {
+        reads.pop();
+        throw;
+    }
+
+    this->agent->log(0, "Axi read start");
+
+    // Memory is prefetched as a whole, other ranges are read beat by beat when the beat is sent
+    transaction.prefetched = this->agent->isMemoryBacked(transaction.regionStart, transaction.regionSize);
+    transaction.fetched = 0;
+    if(transaction.prefetched) {
+        transaction.data.resize(transaction.regionSize);
+        sprintf(buffer, "Axi read from: 0x%" PRIX64, transaction.regionStart);
+        this->agent->log(0, buffer);
+        fetch(transaction.regionStart, transaction.data.data(), transaction.regionSize);
+    }
+    else {
+        transaction.data.resize(dataBytes);
+    }
+}
+
+void AxiSlave::readHandler()
+{
+    // Handshakes taking place on the upcoming rising edge
+    if(*rready == 1 && *rvalid == 1) {
+        AxiTransaction& transaction = reads.front();
+        transaction.beat++;
+        if(transaction.beat == transaction.len) {
+            reads.pop();
+            this->agent->log(0, "Axi read transfer completed");
+        }
+    }
+
+    if(*arready == 1 && *arvalid == 1)
+        startRead();
+
+    arready_new = !reads.full();
+
+    if(reads.empty()) {
+        rvalid_new = 0;
+        rlast_new = 0;
+        return;
+    }
+
+    // Place the beat in its byte lanes
+    AxiTransaction& transaction = reads.front();
+    uint64_t addr = beatAddress(transaction, transaction.beat);
+    uint64_t busAddr = addr / dataBytes * dataBytes;
+    uint32_t lower = addr - busAddr;
+    uint32_t upper = addr / transaction.numBytes * transaction.numBytes + transaction.numBytes - busAddr;
+    uint8_t* data = transaction.data.data();
+    if(transaction.prefetched) {
+        data += busAddr - transaction.regionStart;
+    }
+    else if(transaction.fetched == transaction.beat) {
+        sprintf(buffer, "Axi read from: 0x%" PRIX64, addr);
+        this->agent->log(0, buffer);
+        fetch(addr, data + lower, upper - lower);
+        transaction.fetched++;
+    }
+
+    memset(rdata_new, 0, dataBytes);
+    memcpy(rdata_new + lower, data + lower, upper - lower);
+
+    rvalid_new = 1;
+    rlast_new  = transaction.beat == transaction.len - 1;
+    rid_new    = transaction.id;
+}
+
 void AxiSlave::writeWord(uint64_t addr, uint64_t data, uint8_t strb)
 {
     sprintf(buffer, "Axi write to: 0x%" PRIX64 ", data: 0x%" PRIX64 "", addr, data);
     this->agent->log(0, buffer);
-    this->agent->pushToAgent(writeAddr, *wdata);
+    uint8_t bytes[8];
+    memcpy(bytes, &data, 8);
+    writeBeat(addr, bytes, strb);
 }
 
-void AxiSlave::writeHandler()
+void AxiSlave::writeBeat(uint64_t addr, const uint8_t* data, uint64_t strobe)
+{
+    uint32_t i = 0;
+    while(i < dataBytes) {
+        if(!(strobe & (1ULL << i))) {
+            i++;
+            continue;
+        }
+        uint32_t start = i;
+        while(i < dataBytes && (strobe & (1ULL << i)))
+            i++;
+        pushRun(addr + start, data + start, i - start);
+    }
+}
+
+void AxiSlave::pushRun(uint64_t addr, const uint8_t* data, uint64_t size)
 {
-    switch(writeState) {
-        case AxiWriteState::AW:
-            awready_new = 1;
-            if(*awready == 1 && *awvalid == 1) {
-                awready_new    = 0;
+    if(size > 1 && this->agent->isMemoryBacked(addr, size)) {
+        this->agent->pushBlockToAgent(addr, data, size);
+        return;
+    }
 
-                writeNumBytes  = pow(2, *awsize);
-                writeState     = AxiWriteState::W;
-                writeBurstType = static_cast<AxiBurstType>(*awburst);
-                writeAddr      = uint64_t((*awaddr)/writeNumBytes) * writeNumBytes;
+    uint64_t i = 0;
+    while(i < size) {
+        uint64_t chunk = accessSize(addr + i, size - i);
+        uint32_t value = 0;
+        memcpy(&value, data + i, chunk);
+        if(chunk == 4)
+            this->agent->pushDoubleWordToAgent(addr + i, value);
+        else if(chunk == 2)
+            this->agent->pushWordToAgent(addr + i, value);
+        else
+            this->agent->pushByteToAgent(addr + i, value);
+        i += chunk;
+    }
+}
+
+void AxiSlave::flushWrite(AxiTransaction& transaction)
+{
+    uint64_t i = 0;
+    while(i < transaction.regionSize) {
+        if(!transaction.strobes[i]) {
+            i++;
+            continue;
+        }
+        uint64_t start = i;
+        while(i < transaction.regionSize && transaction.strobes[i])
+            i++;
+        pushRun(transaction.regionStart + start, transaction.data.data() + start, i - start);
+    }
+}
 
-                if(writeAddr != *awaddr)
-                    throw "Unaligned transfers are not supported";
+void AxiSlave::startWrite()
+{
+    AxiTransaction& transaction = writes.push();
+    try {
+        startTransaction(transaction, awid != nullptr ? *awid : 0, *awaddr, *awlen, *awsize, *awburst);
+    }
+    catch(const char*) {
+        writes.pop();
+        throw;
+    }
 
-                if(writeBurstType != AxiBurstType::INCR)
-                    throw "Unsupported AXI write burst type";
+    if(transaction.burstType != AxiBurstType::FIXED) {
+        transaction.data.resize(transaction.regionSize);
+        transaction.strobes.assign(transaction.regionSize, 0);
+    }
 
-                if(writeNumBytes != int(dataWidth/8))
-                    throw "Narrow bursts are not supported";
+    this->agent->log(0, "Axi write start");
+}
 
-                this->agent->log(0, "Axi write start");
-            }
-            break;
-        case AxiWriteState::W:
-            wready_new = 1;
-            if(*wready == 1 && *wvalid == 1) {
-                writeWord(writeAddr, *wdata, *wstrb);
-                if(*wlast) {
-                    writeState = AxiWriteState::B;
-                    wready_new = 0;
-                } else {
-                    writeAddr += int(dataWidth/8); // TODO: make data width configurable
+void AxiSlave::writeHandler()
+{
+    // Handshakes taking place on the upcoming rising edge
+    if(*bready == 1 && *bvalid == 1) {
+        writeResponses.pop();
+        this->agent->log(0, "Axi write transfer completed");
+    }
+
+    if(*wready == 1 && *wvalid == 1) {
+        AxiTransaction& transaction = writes.front();
+        uint64_t addr = beatAddress(transaction, transaction.beat);
+        uint64_t busAddr = addr / dataBytes * dataBytes;
+        uint32_t lower = addr - busAddr;
+        uint32_t upper = addr / transaction.numBytes * transaction.numBytes + transaction.numBytes - busAddr;
+
+        uint8_t data[AXI_MAX_DATA_BYTES];
+        wdata.getBytes(data, dataBytes);
+        uint64_t strobe = wstrb.get(strobeBytes);
+        // Ignore strobes outside of the active byte lanes
+        uint64_t lanes = (upper == 64 ? UINT64_MAX : (1ULL << upper) - 1) & ~((1ULL << lower) - 1);
+
+        sprintf(buffer, "Axi write to: 0x%" PRIX64, addr);
+        this->agent->log(0, buffer);
+
+        if(transaction.burstType == AxiBurstType::FIXED) {
+            writeBeat(busAddr, data, strobe & lanes);
+        }
+        else {
+            uint64_t offset = busAddr - transaction.regionStart;
+            for(uint32_t i = lower; i < upper; i++) {
+                if(strobe & (1ULL << i)) {
+                    transaction.data[offset + i] = data[i];
+                    transaction.strobes[offset + i] = 1;
                 }
             }
-            break;
-        case AxiWriteState::B:
-            bvalid_new = 1;
-            if(*bready == 1 && *bvalid == 1) {
-                bvalid_new = 0;
-                writeState = AxiWriteState::AW;
-                this->agent->log(0, "Axi write transfer completed");
-            }
-            break;
-        default:
-            writeState = AxiWriteState::AW;
-            break;
+        }
+
+        transaction.beat++;
+        if(*wlast) {
+            if(transaction.burstType != AxiBurstType::FIXED)
+                flushWrite(transaction);
+            writeResponses.push() = transaction.id;
+            writes.pop();
+        }
     }
+
+    if(*awready == 1 && *awvalid == 1)
+        startWrite();
+
+    awready_new = !writes.full();
+    // Write data is accepted once its address is known and there's room for the response
+    wready_new  = !writes.empty() && !writeResponses.full();
+    bvalid_new  = !writeResponses.empty();
+    if(bvalid_new)
+        bid_new = writeResponses.front();
 }
 
 void AxiSlave::reset()
@@ -224,13 +414,100 @@ void AxiSlave::reset()
     tick(true);
 }
 
+void AxiSlave::saveState(StateWriter& state)
+{
+    BaseInitiatorBus::saveState(state);
+    saveTransactions(state, reads);
+    saveTransactions(state, writes);
+    state.write(writeResponses.count);
+    for(size_t i = 0; i < writeResponses.count; i++)
+        state.write(writeResponses.items[(writeResponses.head + i) % writeResponses.items.size()]);
+
+    state.write(awready_new);
+    state.write(wready_new);
+    state.write(bvalid_new);
+    state.write(bid_new);
+    state.write(arready_new);
+    state.write(rvalid_new);
+    state.write(rlast_new);
+    state.write(rid_new);
+    state.write(rdata_new);
+}
+
+void AxiSlave::loadState(StateReader& state)
+{
+    BaseInitiatorBus::loadState(state);
+    loadTransactions(state, reads);
+    loadTransactions(state, writes);
+    state.read(writeResponses.count);
+    if(writeResponses.count > writeResponses.items.size())
+        throw "Malformed state";
+    writeResponses.head = 0;
+    for(size_t i = 0; i < writeResponses.count; i++)
+        state.read(writeResponses.items[i]);
+
+    state.read(awready_new);
+    state.read(wready_new);
+    state.read(bvalid_new);
+    state.read(bid_new);
+    state.read(arready_new);
+    state.read(rvalid_new);
+    state.read(rlast_new);
+    state.read(rid_new);
+    state.read(rdata_new);
+}
+
+// Only the outstanding transactions are saved, the oldest one first
+void AxiSlave::saveTransactions(StateWriter& state, AxiQueue<AxiTransaction>& queue)
+{
+    state.write(queue.count);
+    for(size_t i = 0; i < queue.count; i++) {
+        AxiTransaction& transaction = queue.items[(queue.head + i) % queue.items.size()];
+        state.write(transaction.id);
+        state.write(transaction.addr);
+        state.write(transaction.len);
+        state.write(transaction.numBytes);
+        state.write(transaction.beat);
+        state.write(transaction.burstType);
+        state.write(transaction.regionStart);
+        state.write(transaction.regionSize);
+        state.write(transaction.prefetched);
+        state.write(transaction.fetched);
+        state.write(transaction.data);
+        state.write(transaction.strobes);
+    }
+}
+
+void AxiSlave::loadTransactions(StateReader& state, AxiQueue<AxiTransaction>& queue)
+{
+    state.read(queue.count);
+    if(queue.count > queue.items.size())
+        throw "Malformed state";
+    queue.head = 0;
+    for(size_t i = 0; i < queue.count; i++) {
+        AxiTransaction& transaction = queue.items[i];
+        state.read(transaction.id);
+        state.read(transaction.addr);
+        state.read(transaction.len);
+        state.read(transaction.numBytes);
+        state.read(transaction.beat);
+        state.read(transaction.burstType);
+        state.read(transaction.regionStart);
+        state.read(transaction.regionSize);
+        state.read(transaction.prefetched);
+        state.read(transaction.fetched);
+        state.read(transaction.data);
+        state.read(transaction.strobes);
+    }
+}
+
 // You can't read/write using slave bus
-void AxiSlave::write(uint64_t addr, uint64_t value)
+void AxiSlave::write(uint64_t /* addr */, uint64_t /* value */)
 {
     throw "Unsupported";
 }
 
-uint64_t AxiSlave::read(uint64_t addr)
+uint64_t AxiSlave::read(uint64_t /* addr */)
 {
     throw "Unsupported";
 }
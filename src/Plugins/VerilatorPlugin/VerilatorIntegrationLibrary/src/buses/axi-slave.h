@@ -9,9 +9,53 @@
 #include "axi.h"
 #include <src/renode_bus.h>
 
-enum class AxiReadState  {AR, R};
-enum class AxiWriteState {AW, W, B};
+#ifndef AXI_MAX_OUTSTANDING
+#define AXI_MAX_OUTSTANDING 8
+#endif
+
+// Fixed-capacity FIFO, doesn't allocate once created
+template<typename T>
+struct AxiQueue
+{
+    AxiQueue(size_t capacity) : items(capacity), head(0), count(0) {}
+    bool empty() const { return count == 0; }
+    bool full() const { return count == items.size(); }
+    T& front() { return items[head]; }
+    T& push() { T& item = items[(head + count) % items.size()]; count++; return item; }
+    void pop() { head = (head + 1) % items.size(); count--; }
+
+    std::vector<T> items;
+    size_t head;
+    size_t count;
+};
+
+struct AxiTransaction
+{
+    uint8_t      id;
+    uint64_t     addr;
+    uint32_t     len;       // number of beats
+    uint32_t     numBytes;  // bytes per beat
+    uint32_t     beat;      // current beat
+    AxiBurstType burstType;
 
+    // Memory accessed by the burst. For FIXED bursts it's a single beat.
+    uint64_t regionStart;
+    uint64_t regionSize;
+    // Read data is either the whole region (prefetched) or the current beat in its byte lanes
+    bool     prefetched;
+    uint32_t fetched;   // beats read so far, if not prefetched
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> strobes;
+};
+
+// Up to AXI_MAX_OUTSTANDING reads and writes are accepted before the previous ones complete.
+// Read bursts within memory (see RenodeAgent::isMemoryBacked) are requested from Renode at
+// once when the burst is accepted, other reads beat by beat when the beat is about to be sent.
+// The data of a write burst is sent to Renode once the last beat is received, as runs of the
+// bytes selected by the write strobes. Beats of FIXED write bursts are transferred one by one.
+// Only memory is accessed in blocks, anything else in naturally aligned bytes, words and
+// double words, so peripherals see the width of the transfer.
+// Responses are returned in order.
 struct AxiSlave : public BaseAxi, public BaseInitiatorBus
 {
     AxiSlave(uint32_t dataWidth, uint32_t addrWidth);
@@ -20,6 +64,8 @@ struct AxiSlave : public BaseAxi, public BaseInitiatorBus
     virtual void write(uint64_t addr, uint64_t value);
     virtual uint64_t read(uint64_t addr);
     virtual void reset();
+    void saveState(StateWriter& state) override;
+    void loadState(StateReader& state) override;
 
     void readWord(uint64_t addr, uint8_t sel);
     void writeWord(uint64_t addr, uint64_t data, uint8_t strb);
@@ -29,30 +75,40 @@ struct AxiSlave : public BaseAxi, public BaseInitiatorBus
     void writeHandler();
     void readHandler();
 
+    // Transfers a beat of the width of the bus, `strobe` selects the bytes to write
+    void readBeat(uint64_t addr, uint8_t* data);
+    void writeBeat(uint64_t addr, const uint8_t* data, uint64_t strobe);
+
     bool hasSpecifiedAdress() override { throw "unimplemented"; }
     uint64_t getSpecifiedAdress() override { throw "unimplemented"; }
 
-    AxiWriteState writeState;
-    AxiReadState  readState;
+    AxiQueue<AxiTransaction> reads;
+    AxiQueue<AxiTransaction> writes;
+    AxiQueue<uint8_t>        writeResponses;
 
     uint8_t awready_new;
     uint8_t wready_new;
     uint8_t bvalid_new;
+    uint8_t bid_new;
 
     uint8_t arready_new;
     uint8_t rvalid_new;
     uint8_t rlast_new;
-    uint64_t rdata_new;
-
-    AxiBurstType  writeBurstType;
-    uint64_t      writeAddr;
-    uint8_t       writeNumBytes;
-
-    AxiBurstType  readBurstType;
-    uint64_t      readAddr;
-    uint8_t       readLen;
-    uint8_t       readNumBytes;
+    uint8_t rid_new;
+    uint8_t rdata_new[AXI_MAX_DATA_BYTES];
 
     char buffer [50];
+
+private:
+    void startTransaction(AxiTransaction& transaction, uint8_t id, uint64_t addr, uint8_t len, uint8_t size, uint8_t burst);
+    uint64_t beatAddress(const AxiTransaction& transaction, uint32_t beat);
+    void startRead();
+    void startWrite();
+    void fetch(uint64_t addr, uint8_t* data, uint64_t size);
+    uint64_t accessSize(uint64_t addr, uint64_t size);
+    void pushRun(uint64_t addr, const uint8_t* data, uint64_t size);
+    void flushWrite(AxiTransaction& transaction);
+    void saveTransactions(StateWriter& state, AxiQueue<AxiTransaction>& queue);
+    void loadTransactions(StateReader& state, AxiQueue<AxiTransaction>& queue);
 };
 #endif
@@ -6,13 +6,16 @@
 //
 #include "axi.h"
 #include <cmath>
+#include <algorithm>
 
 BaseAxi::BaseAxi(uint32_t dataWidth, uint32_t addrWidth)
 {
-    if(dataWidth != 32)
+    if(dataWidth != 32 && dataWidth != 64 && dataWidth != 128 && dataWidth != 256 && dataWidth != 512)
         throw "Unsupported AXI data width";
 
     this->dataWidth = dataWidth;
+    this->dataBytes = dataWidth / 8;
+    this->strobeBytes = (dataBytes + 7) / 8;
 
     if(addrWidth != 32)
         throw "Unsupported AXI address width";
@@ -20,6 +23,14 @@ BaseAxi::BaseAxi(uint32_t dataWidth, uint32_t addrWidth)
     this->addrWidth = addrWidth;
 }
 
+uint8_t BaseAxi::encodeSize(uint32_t bytes)
+{
+    uint8_t size = 0;
+    while((1u << size) < bytes)
+        size++;
+    return size;
+}
+
 Axi::Axi(uint32_t dataWidth, uint32_t addrWidth) : BaseAxi(dataWidth, addrWidth)
 {
 }
@@ -31,6 +42,7 @@ void Axi::tick(bool countEnable, uint64_t steps = 1)
         evaluateModel();
         *aclk = 0;
         evaluateModel();
+        cycleTicked();
     }
 
     if(countEnable) {
@@ -52,8 +64,16 @@ void Axi::timeoutTick(uint8_t *signal, uint8_t value, int timeout = DEFAULT_TIME
 
 void Axi::write(int width, uint64_t addr, uint64_t value)
 {
-    *awlen   = 0; // TODO: Variable write length
-    *awsize  = 2; // TODO: Variable write width
+    if(width > (int)dataBytes)
+        throw "Unsupported AXI transfer width";
+
+    // Narrow transfer in the byte lanes selected by the address
+    uint32_t lane = addr % dataBytes;
+    uint8_t data[AXI_MAX_DATA_BYTES] = {0};
+    memcpy(data + lane, &value, width);
+
+    *awlen   = 0;
+    *awsize  = encodeSize(width);
     *awburst = static_cast<uint8_t>(AxiBurstType::INCR);
     *awaddr  = addr;
 
@@ -68,9 +88,9 @@ void Axi::write(int width, uint64_t addr, uint64_t value)
     this->agent->log(0, "Axi write - W");
 
     *wvalid = 1;
-    *wdata = value;
-    *wstrb = (1 << width) - 1; // TODO: Byte selects
-    *wlast = 1; // TODO: Variable write length
+    wdata.setBytes(data, dataBytes);
+    wstrb.set(((1ULL << width) - 1) << lane, strobeBytes);
+    *wlast = 1;
 
     if (*wready != 1)
         timeoutTick(wready, 1);
@@ -80,19 +100,24 @@ void Axi::write(int width, uint64_t addr, uint64_t value)
     this->agent->log(0, "Axi write - B");
 
     *bready = 1;
-
-    timeoutTick(bvalid, 1);
+    if (*bvalid != 1)
+        timeoutTick(bvalid, 1);
     tick(true);
     *bready = 0;
 }
 
 uint64_t Axi::read(int width, uint64_t addr)
 {
-    uint64_t result;
+    if(width > (int)dataBytes)
+        throw "Unsupported AXI transfer width";
+
+    uint64_t result = 0;
+    uint32_t lane = addr % dataBytes;
+    uint8_t data[AXI_MAX_DATA_BYTES];
 
     *arvalid = 1;
-    *arlen   = 0; // TODO: Variable read length
-    *arsize  = 2; // TODO: Variable read width
+    *arlen   = 0;
+    *arsize  = encodeSize(width);
     *arburst = static_cast<uint8_t>(AxiBurstType::INCR);
     *araddr  = addr;
 
@@ -106,15 +131,154 @@ uint64_t Axi::read(int width, uint64_t addr)
     this->agent->log(0, "Axi read - R");
 
     *rready = 1;
-
-    timeoutTick(rvalid, 1);
-    result = *rdata;
+    if (*rvalid != 1)
+        timeoutTick(rvalid, 1);
+    rdata.getBytes(data, dataBytes);
+    memcpy(&result, data + lane, width);
     tick(true);
     *rready = 0;
 
     return result;
 }
 
+void Axi::validateBurst(uint64_t addr, uint32_t len, AxiBurstType type)
+{
+    if(addr % dataBytes != 0)
+        throw "Unaligned AXI burst";
+
+    switch(type) {
+        case AxiBurstType::INCR:
+            if(len == 0 || len > AXI_MAX_BURST_LENGTH)
+                throw "Unsupported AXI burst length";
+            if(addr / AXI_BURST_BOUNDARY != (addr + len * dataBytes - 1) / AXI_BURST_BOUNDARY)
+                throw "AXI burst crosses a 4KB boundary";
+            break;
+        case AxiBurstType::WRAP:
+            if(len != 2 && len != 4 && len != 8 && len != 16)
+                throw "Unsupported AXI burst length";
+            break;
+        default:
+            throw "Unsupported AXI burst type";
+    }
+}
+
+// Number of beats of the next INCR burst of a block transfer
+uint32_t Axi::blockBurstLength(uint64_t addr, uint64_t size)
+{
+    uint64_t beats = size / dataBytes;
+    uint64_t beatsToBoundary = (AXI_BURST_BOUNDARY - addr % AXI_BURST_BOUNDARY) / dataBytes;
+    return std::min<uint64_t>({beats, beatsToBoundary, AXI_MAX_BURST_LENGTH});
+}
+
+void Axi::writeBurst(uint64_t addr, uint32_t len, const uint8_t* data, AxiBurstType type)
+{
+    validateBurst(addr, len, type);
+
+    *awlen   = len - 1;
+    *awsize  = encodeSize(dataBytes);
+    *awburst = static_cast<uint8_t>(type);
+    *awaddr  = addr;
+
+    this->agent->log(0, "Axi burst write - AW");
+
+    *awvalid = 1;
+    if (*awready != 1)
+        timeoutTick(awready, 1);
+    tick(true);
+    *awvalid = 0;
+
+    this->agent->log(0, "Axi burst write - W");
+
+    wstrb.set(dataBytes == 64 ? UINT64_MAX : (1ULL << dataBytes) - 1, strobeBytes);
+    for(uint32_t i = 0; i < len; i++) {
+        *wvalid = 1;
+        wdata.setBytes(data + i * dataBytes, dataBytes);
+        *wlast = i == len - 1;
+
+        if (*wready != 1)
+            timeoutTick(wready, 1);
+        tick(true);
+    }
+    *wvalid = 0;
+    *wlast = 0;
+
+    this->agent->log(0, "Axi burst write - B");
+
+    *bready = 1;
+    if (*bvalid != 1)
+        timeoutTick(bvalid, 1);
+    tick(true);
+    *bready = 0;
+}
+
+void Axi::readBurst(uint64_t addr, uint32_t len, uint8_t* data, AxiBurstType type)
+{
+    validateBurst(addr, len, type);
+
+    *arvalid = 1;
+    *arlen   = len - 1;
+    *arsize  = encodeSize(dataBytes);
+    *arburst = static_cast<uint8_t>(type);
+    *araddr  = addr;
+
+    this->agent->log(0, "Axi burst read - AR");
+
+    if (*arready != 1)
+        timeoutTick(arready, 1);
+    tick(true);
+    *arvalid = 0;
+
+    this->agent->log(0, "Axi burst read - R");
+
+    *rready = 1;
+    for(uint32_t i = 0; i < len; i++) {
+        if (*rvalid != 1)
+            timeoutTick(rvalid, 1);
+        rdata.getBytes(data + i * dataBytes, dataBytes);
+        tick(true);
+    }
+    *rready = 0;
+}
+
+void Axi::writeBlock(uint64_t addr, const uint8_t* data, uint64_t size)
+{
+    // Parts not aligned to the data width are transferred using single accesses
+    uint64_t head = std::min<uint64_t>((dataBytes - addr % dataBytes) % dataBytes, size);
+    BaseTargetBus::writeBlock(addr, data, head);
+    addr += head;
+    data += head;
+    size -= head;
+
+    while(size >= dataBytes) {
+        uint32_t len = blockBurstLength(addr, size);
+        writeBurst(addr, len, data);
+        addr += len * dataBytes;
+        data += len * dataBytes;
+        size -= len * dataBytes;
+    }
+
+    BaseTargetBus::writeBlock(addr, data, size);
+}
+
+void Axi::readBlock(uint64_t addr, uint8_t* data, uint64_t size)
+{
+    uint64_t head = std::min<uint64_t>((dataBytes - addr % dataBytes) % dataBytes, size);
+    BaseTargetBus::readBlock(addr, data, head);
+    addr += head;
+    data += head;
+    size -= head;
+
+    while(size >= dataBytes) {
+        uint32_t len = blockBurstLength(addr, size);
+        readBurst(addr, len, data);
+        addr += len * dataBytes;
+        data += len * dataBytes;
+        size -= len * dataBytes;
+    }
+
+    BaseTargetBus::readBlock(addr, data, size);
+}
+
 void Axi::reset()
 {
     *aresetn = 1;
@@ -11,19 +11,72 @@
 
 enum class AxiBurstType  {FIXED = 0, INCR = 1, WRAP = 2, RESERVED = 3};
 
+#define AXI_MAX_BURST_LENGTH 256
+#define AXI_BURST_BOUNDARY 4096
+#define AXI_MAX_DATA_BYTES 64
+
+// Data or strobe signal of a verilated model. Verilator uses CData/SData/IData/QData
+// for signals of up to 64 bits and arrays of 32-bit words (WData) for the wider ones,
+// all of them little-endian, so signals are accessed bytewise regardless of the type.
+// The size of the signal in bytes is provided by the bus.
+struct AxiSignal
+{
+    AxiSignal() : pointer(nullptr) {}
+    AxiSignal(uint8_t* signal) : pointer(signal) {}
+    AxiSignal(uint16_t* signal) : pointer(reinterpret_cast<uint8_t*>(signal)) {}
+    AxiSignal(uint32_t* signal) : pointer(reinterpret_cast<uint8_t*>(signal)) {}
+    AxiSignal(uint64_t* signal) : pointer(reinterpret_cast<uint8_t*>(signal)) {}
+    // WData array
+    template<size_t N>
+    AxiSignal(uint32_t (*signal)[N]) : pointer(reinterpret_cast<uint8_t*>(*signal)) {}
+    // VlWide (Verilator 5)
+    template<typename Wide>
+    AxiSignal(Wide* signal) : pointer(reinterpret_cast<uint8_t*>(signal->data())) {}
+
+    uint64_t get(uint32_t bytes) const
+    {
+        uint64_t value = 0;
+        memcpy(&value, pointer, bytes < 8 ? bytes : 8);
+        return value;
+    }
+
+    void set(uint64_t value, uint32_t bytes)
+    {
+        memset(pointer, 0, bytes);
+        memcpy(pointer, &value, bytes < 8 ? bytes : 8);
+    }
+
+    void getBytes(uint8_t* data, uint32_t bytes) const
+    {
+        memcpy(data, pointer, bytes);
+    }
+
+    void setBytes(const uint8_t* data, uint32_t bytes)
+    {
+        memcpy(pointer, data, bytes);
+    }
+
+    uint8_t* pointer;
+};
+
 struct BaseAxi
 {
     BaseAxi(uint32_t dataWidth, uint32_t addrWidth);
 
+    // AxSIZE encoding of a transfer of `bytes` bytes
+    static uint8_t encodeSize(uint32_t bytes);
+
     uint32_t dataWidth;
     uint32_t addrWidth;
+    uint32_t dataBytes;
+    uint32_t strobeBytes;
 
     // Global AXI Signals
     uint8_t  *aclk;
     uint8_t  *aresetn;
 
     // Write Address Channel Signals
-    uint8_t  *awid;
+    uint8_t  *awid = nullptr; // optional
     uint32_t *awaddr;
     uint8_t  *awlen;
     uint8_t  *awsize;
@@ -38,22 +91,22 @@ struct BaseAxi
     uint8_t  *awready;
 
     // Write Data Channel Signals
-    uint32_t *wdata;
-    uint8_t  *wstrb;
+    AxiSignal wdata;
+    AxiSignal wstrb;
     uint8_t  *wlast;
     uint8_t  *wuser;
     uint8_t  *wvalid;
     uint8_t  *wready;
 
     // Write Response Channel Signals
-    uint8_t  *bid;
+    uint8_t  *bid = nullptr; // optional
     uint8_t  *bresp;
     uint8_t  *buser;
     uint8_t  *bvalid;
     uint8_t  *bready;
 
     // Read Address Channel Signals
-    uint8_t  *arid;
+    uint8_t  *arid = nullptr; // optional
     uint32_t *araddr;
     uint8_t  *arlen;
     uint8_t  *arsize;
@@ -68,8 +121,8 @@ struct BaseAxi
     uint8_t  *arready;
 
     // Read Data Channel Signals
-    uint8_t  *rid;
-    uint32_t *rdata;
+    uint8_t  *rid = nullptr; // optional
+    AxiSignal rdata;
     uint8_t  *rresp;
     uint8_t  *rlast;
     uint8_t  *ruser;
@@ -83,8 +136,19 @@ struct Axi : public BaseAxi, public BaseTargetBus
     virtual void tick(bool countEnable, uint64_t steps);
     virtual void write(int width, uint64_t addr, uint64_t value);
     virtual uint64_t read(int width, uint64_t addr);
+    virtual void writeBlock(uint64_t addr, const uint8_t* data, uint64_t size);
+    virtual void readBlock(uint64_t addr, uint8_t* data, uint64_t size);
     virtual void reset();
 
+    // Bursts of `len` full-width beats: INCR up to 256 beats, WRAP of 2, 4, 8 or 16 beats.
+    // `data` holds `len * dataBytes` bytes.
+    void writeBurst(uint64_t addr, uint32_t len, const uint8_t* data, AxiBurstType type = AxiBurstType::INCR);
+    void readBurst(uint64_t addr, uint32_t len, uint8_t* data, AxiBurstType type = AxiBurstType::INCR);
+
     void timeoutTick(uint8_t *signal, uint8_t value, int timeout);
+
+private:
+    void validateBurst(uint64_t addr, uint32_t len, AxiBurstType type);
+    uint32_t blockBurstLength(uint64_t addr, uint64_t size);
 };
 #endif
@@ -11,6 +11,7 @@ void AxiLite::tick(bool countEnable, uint64_t steps = 1)
     for(uint64_t i = 0; i < steps; i++) {
         setSignal<uint8_t>(clk, 1);
         setSignal<uint8_t>(clk, 0);
+        cycleTicked();
     }
 
     if(countEnable) {
@@ -8,20 +8,98 @@
 #define BaseBus_H
 
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
 #ifndef DEFAULT_TIMEOUT
 #define DEFAULT_TIMEOUT 2000
 #endif
 
+#ifndef DEFAULT_IDLE_CHECK_INTERVAL
+#define DEFAULT_IDLE_CHECK_INTERVAL 100
+#endif
+
 class RenodeAgent;
 
+// Binary state of the buses and the agent, values are stored as they are in memory
+class StateWriter
+{
+public:
+    StateWriter(std::vector<uint8_t>& data) : data(data) {}
+
+    void write(const void* value, size_t size)
+    {
+        const uint8_t* bytes = (const uint8_t*)value;
+        data.insert(data.end(), bytes, bytes + size);
+    }
+
+    template<typename T>
+    void write(const T& value)
+    {
+        write(&value, sizeof(value));
+    }
+
+    // The size followed by the contents
+    void write(const std::vector<uint8_t>& value)
+    {
+        write<uint64_t>(value.size());
+        write(value.data(), value.size());
+    }
+
+private:
+    std::vector<uint8_t>& data;
+};
+
+class StateReader
+{
+public:
+    StateReader(const uint8_t* data, size_t size) : data(data), remaining(size) {}
+
+    void read(void* value, size_t size)
+    {
+        if(size > remaining) {
+            throw "Malformed state";
+        }
+        memcpy(value, data, size);
+        data += size;
+        remaining -= size;
+    }
+
+    template<typename T>
+    void read(T& value)
+    {
+        read(&value, sizeof(value));
+    }
+
+    void read(std::vector<uint8_t>& value)
+    {
+        uint64_t size;
+        read(size);
+        if(size > remaining) {
+            throw "Malformed state";
+        }
+        value.resize(size);
+        read(value.data(), size);
+    }
+
+    bool atEnd() const { return remaining == 0; }
+
+private:
+    const uint8_t* data;
+    size_t remaining;
+};
+
 class BaseBus
 {
 public:
     BaseBus() : agent(nullptr), tickCounter(0) {}
+    virtual ~BaseBus() {}
     virtual void tick(bool countEnable, uint64_t steps) = 0;
     virtual void timeoutTick(uint8_t* signal, uint8_t expectedValue, int timeout) = 0;
     virtual void reset() = 0;
+    // State of the bus kept outside of the model, buses with their own state machines extend it
+    virtual void saveState(StateWriter& state) { state.write(tickCounter); }
+    virtual void loadState(StateReader& state) { state.read(tickCounter); }
     void (*evaluateModel)();
     virtual void setAgent(RenodeAgent *newAgent)
     {
@@ -31,6 +109,15 @@ protected:
     friend class RenodeAgent;
     RenodeAgent *agent;
     uint64_t tickCounter;
+    // Set by the agent if it has to know about every cycle, see RenodeAgent::updateCycleNotifications
+    void (*onCycle)(RenodeAgent* agent) = nullptr;
+
+    // Called by the bus after every cycle simulated by `tick`
+    void cycleTicked()
+    {
+        if(onCycle)
+            onCycle(agent);
+    }
     template<typename T>
     void setSignal(T* signal, T value)
     {
@@ -44,6 +131,39 @@ class BaseTargetBus : public BaseBus
 public:
     virtual void write(int width, uint64_t addr, uint64_t value) = 0;
     virtual uint64_t read(int width, uint64_t addr) = 0;
+
+    // Block transfers split into double word accesses by default,
+    // buses supporting bursts should override them.
+    virtual void writeBlock(uint64_t addr, const uint8_t* data, uint64_t size)
+    {
+        while(size > 0) {
+            if(addr % 4 == 0 && size >= 4) {
+                uint32_t value;
+                memcpy(&value, data, 4);
+                write(4, addr, value);
+                addr += 4; data += 4; size -= 4;
+            }
+            else {
+                write(1, addr, *data);
+                addr += 1; data += 1; size -= 1;
+            }
+        }
+    }
+
+    virtual void readBlock(uint64_t addr, uint8_t* data, uint64_t size)
+    {
+        while(size > 0) {
+            if(addr % 4 == 0 && size >= 4) {
+                uint32_t value = read(4, addr);
+                memcpy(data, &value, 4);
+                addr += 4; data += 4; size -= 4;
+            }
+            else {
+                *data = read(1, addr);
+                addr += 1; data += 1; size -= 1;
+            }
+        }
+    }
 };
 
 class BaseInitiatorBus : public BaseBus
@@ -0,0 +1,52 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef FastTickBus_H
+#define FastTickBus_H
+#include <utility>
+#include "bus.h"
+
+// Replaces the clock loop of `Bus` with one in which the clock signal and the
+// model evaluation are known at compile time, so `Model::eval` is called directly
+// (and can be inlined with LTO or a unity build) instead of through `evaluateModel`.
+// `Clock` selects the clock signal of the model, e.g.:
+//
+//   struct TopClock { static uint8_t& signal(Vtop& top) { return top.clk; } };
+//   FastTickBus<AxiLite, Vtop, TopClock>* bus = new FastTickBus<AxiLite, Vtop, TopClock>(top);
+//
+// Only suitable for buses whose `tick` does nothing but toggle the clock
+// (APB3, Axi, AxiLite, Cfu, Wishbone). Other signals are still driven through
+// the `Bus` members and `evaluateModel`, which have to be set as usual.
+template<typename Bus, typename Model, typename Clock>
+struct FastTickBus final : public Bus
+{
+    template<typename... Args>
+    FastTickBus(Model* model, Args&&... args) : Bus(std::forward<Args>(args)...), model(model) {}
+
+    void tick(bool countEnable, uint64_t steps) override
+    {
+        tickFast(countEnable, steps);
+    }
+
+    inline void tickFast(bool countEnable, uint64_t steps)
+    {
+        uint8_t& clock = Clock::signal(*model);
+        for(uint64_t i = 0; i < steps; i++) {
+            clock = 1;
+            model->eval();
+            clock = 0;
+            model->eval();
+            this->cycleTicked();
+        }
+
+        if(countEnable) {
+            this->tickCounter += steps;
+        }
+    }
+
+    Model* model;
+};
+#endif
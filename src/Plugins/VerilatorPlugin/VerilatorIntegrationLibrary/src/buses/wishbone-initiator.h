@@ -16,7 +16,7 @@ class WishboneInitiator : public WishboneBase, public BaseInitiatorBus
 {
 public:
     WishboneInitiator()
-        : readState(0), writeState(0)
+        : readState(0), writeState(0), pendingAck(false)
     {
     }
 
@@ -30,6 +30,7 @@ public:
             evaluateModel();
             *wb_clk = low;
             evaluateModel();
+            cycleTicked();
         }
 
         clearSignals();
@@ -64,51 +65,21 @@ public:
         agent->log(LOG_LEVEL_NOISY, "Wishbone write to: 0x%" PRIX64 ", data: 0x%" PRIX64 ", sel: %i", addr, data, int(sel));
 #endif
 
-        switch (sel)
-        {
-        case 1 << 0:
-            agent->pushByteToAgent(addr, ((uint8_t *)&data)[0]);
-            break;
-        case 1 << 1:
-            agent->pushByteToAgent(addr + 1, ((uint8_t *)&data)[1]);
-            break;
-        case 1 << 2:
-            agent->pushByteToAgent(addr + 2, ((uint8_t *)&data)[2]);
-            break;
-        case 1 << 3:
-            agent->pushByteToAgent(addr + 3, ((uint8_t *)&data)[3]);
-            break;
-
-        case (1 << 0) | (1 << 1):
-            agent->pushWordToAgent(addr, data & 0xFFFF);
-            break;
-        case (1 << 2) | (1 << 3):
-            agent->pushWordToAgent(addr + 2, (data >> 16) & 0xFFFF);
-            break;
-
-        case 15:
+        // Every byte select pattern is a single one-way message, Renode writes only the selected bytes
+        if (sel == 15)
             agent->pushDoubleWordToAgent(addr, data);
-            break;
-
-        default:
-        {
-            uint64_t oldData = agent->requestDoubleWordFromAgent(addr);
-
-            constexpr size_t bits = 8;
-            for (size_t i = 0; i < bits; i++)
-            {
-                if (sel & (1 << i))
-                    ((uint8_t *)&oldData)[i] = ((uint8_t *)&data)[i];
-            }
-
-            agent->pushDoubleWordToAgent(addr, oldData);
-            break;
-        }
-        }
+        else
+            agent->pushDoubleWordMaskedToAgent(addr, data, sel);
     }
 
     void readHandler()
     {
+        if (pipelined)
+        {
+            pipelinedHandler();
+            return;
+        }
+
         switch (readState)
         {
         case 0:
@@ -125,12 +96,44 @@ public:
             *wb_ack = high;
             *wb_rd_dat = data;
             readState = 0;
+            // Registered feedback: the next beat of an incrementing burst is fetched
+            // in advance and acknowledged as soon as the initiator presents it
+            if (burstContinues())
+            {
+                burstAddress = nextBurstAddress(*wb_addr);
+                readWord(burstAddress, *wb_sel);
+                readState = 2;
+            }
+            break;
+        case 2:
+            if (*wb_cyc && *wb_stb && !*wb_we && *wb_addr == burstAddress)
+            {
+                *wb_stall = low;
+                *wb_ack = high;
+                *wb_rd_dat = data;
+                readState = 0;
+                if (burstContinues())
+                {
+                    burstAddress = nextBurstAddress(*wb_addr);
+                    readWord(burstAddress, *wb_sel);
+                    readState = 2;
+                }
+            }
+            else
+            {
+                // The burst has been abandoned, the prefetched data is dropped
+                *wb_ack = low;
+                readState = 0;
+            }
             break;
         }
     }
 
     void writeHandler()
     {
+        if (pipelined)
+            return;
+
         switch (writeState)
         {
         case 0:
@@ -145,17 +148,77 @@ public:
         case 1:
             *wb_stall = high;
             *wb_ack = high;
-            writeState = 0;
+            writeState = burstContinues() ? 2 : 0;
+            break;
+        case 2:
+            // The next beat of an incrementing burst is acknowledged in the cycle it's presented in
+            if (*wb_cyc && *wb_stb && *wb_we)
+            {
+                *wb_stall = low;
+                *wb_ack = high;
+                writeWord(*wb_addr, *wb_wr_dat, *wb_sel);
+                writeState = burstContinues() ? 2 : 0;
+            }
+            else
+            {
+                *wb_ack = low;
+                writeState = 0;
+            }
             break;
         }
     }
 
+    // Pipelined mode: a request is accepted in every cycle and acknowledged in the next one
+    void pipelinedHandler()
+    {
+        *wb_ack = pendingAck ? high : low;
+        if (pendingAck)
+            *wb_rd_dat = data;
+        pendingAck = false;
+
+        *wb_stall = low;
+        if (*wb_cyc && *wb_stb)
+        {
+            if (*wb_we)
+                writeWord(*wb_addr, *wb_wr_dat, *wb_sel);
+            else
+                readWord(*wb_addr, *wb_sel);
+            pendingAck = true;
+        }
+    }
+
     void clearSignals()
     {
-        *wb_stall = high;
+        *wb_stall = pipelined ? low : high;
         *wb_ack = low;
     }
 
+    bool burstContinues()
+    {
+        return wb_cti != nullptr && *wb_cti == (uint8_t)WishboneCycleType::INCREMENTING;
+    }
+
+    uint64_t nextBurstAddress(uint64_t addr)
+    {
+        uint64_t next = addr + sizeof(data_t);
+        uint64_t wrap = 0;
+        switch (wb_bte != nullptr ? (WishboneBurstType)*wb_bte : WishboneBurstType::LINEAR)
+        {
+        case WishboneBurstType::WRAP4:
+            wrap = 4 * sizeof(data_t);
+            break;
+        case WishboneBurstType::WRAP8:
+            wrap = 8 * sizeof(data_t);
+            break;
+        case WishboneBurstType::WRAP16:
+            wrap = 16 * sizeof(data_t);
+            break;
+        default:
+            return next;
+        }
+        return (addr & ~(wrap - 1)) | (next & (wrap - 1));
+    }
+
     void reset()
     {
         *wb_rst = 1;
@@ -164,6 +227,26 @@ public:
         tick(true, 1);
     }
 
+    void saveState(StateWriter& state) override
+    {
+        BaseInitiatorBus::saveState(state);
+        state.write(readState);
+        state.write(writeState);
+        state.write(data);
+        state.write(burstAddress);
+        state.write(pendingAck);
+    }
+
+    void loadState(StateReader& state) override
+    {
+        BaseInitiatorBus::loadState(state);
+        state.read(readState);
+        state.read(writeState);
+        state.read(data);
+        state.read(burstAddress);
+        state.read(pendingAck);
+    }
+
     bool hasSpecifiedAdress() override
     {
         return *wb_cyc && *wb_stb;
@@ -177,6 +260,8 @@ public:
 
     uint8_t readState, writeState;
     uint64_t data;
+    uint64_t burstAddress;
+    bool pendingAck;
 
     static constexpr uint32_t high = 1, low = 0;
 };
@@ -5,6 +5,7 @@
 // Full license text is available in 'licenses/MIT.txt'.
 //
 #include "wishbone.h"
+#include <algorithm>
 #include <cstdio>
 
 void Wishbone::tick(bool countEnable, uint64_t steps = 1)
@@ -14,6 +15,7 @@ void Wishbone::tick(bool countEnable, uint64_t steps = 1)
         evaluateModel();
         *wb_clk = 0;
         evaluateModel();
+        cycleTicked();
     }
 
     if(countEnable) {
@@ -49,12 +51,18 @@ void Wishbone::write(int width, uint64_t addr, uint64_t value)
         sprintf(msg, msg, width);
         throw msg;
     }
+    if(pipelined) {
+        pipelinedTransfer(true, width, addr, &value, 1);
+        return;
+    }
+
+    setCycleType(WishboneCycleType::CLASSIC);
     *wb_we = 1;
     *wb_sel = (uint8_t)((1 << width) - 1);
     *wb_cyc = 1;
     *wb_stb = 1;
 
-    *wb_addr = (addr >> (32 - addr_lines));
+    *wb_addr = busAddress(addr);
     *wb_wr_dat = value;
 
     timeoutTick(wb_ack, 1);
@@ -74,11 +82,18 @@ uint64_t Wishbone::read(int width, uint64_t addr)
         sprintf(msg, msg, width);
         throw msg;
     }
+    if(pipelined) {
+        uint64_t result;
+        pipelinedTransfer(false, width, addr, &result, 1);
+        return result;
+    }
+
+    setCycleType(WishboneCycleType::CLASSIC);
     *wb_we = 0;
     *wb_sel = (uint8_t)((1 << width) - 1);
     *wb_cyc = 1;
     *wb_stb = 1;
-    *wb_addr = (addr >> (32 - addr_lines));
+    *wb_addr = busAddress(addr);
 
     timeoutTick(wb_ack, 1);
     uint64_t result = *wb_rd_dat;
@@ -92,6 +107,153 @@ uint64_t Wishbone::read(int width, uint64_t addr)
     return result;
 }
 
+void Wishbone::writeBlock(uint64_t addr, const uint8_t* data, uint64_t size)
+{
+    int width = 1 << (32 - addr_lines);
+    if((!pipelined && wb_cti == nullptr) || width > 8) {
+        BaseTargetBus::writeBlock(addr, data, size);
+        return;
+    }
+
+    // Unaligned head and tail are written with single accesses
+    uint64_t head = std::min<uint64_t>(size, (width - addr % width) % width);
+    BaseTargetBus::writeBlock(addr, data, head);
+    addr += head; data += head; size -= head;
+
+    uint64_t count = size / width;
+    if(count > 0) {
+        words.assign(count, 0);
+        for(uint64_t i = 0; i < count; i++)
+            memcpy(&words[i], data + i * width, width);
+        transfer(true, width, addr, words.data(), count);
+    }
+
+    BaseTargetBus::writeBlock(addr + count * width, data + count * width, size - count * width);
+}
+
+void Wishbone::readBlock(uint64_t addr, uint8_t* data, uint64_t size)
+{
+    int width = 1 << (32 - addr_lines);
+    if((!pipelined && wb_cti == nullptr) || width > 8) {
+        BaseTargetBus::readBlock(addr, data, size);
+        return;
+    }
+
+    uint64_t head = std::min<uint64_t>(size, (width - addr % width) % width);
+    BaseTargetBus::readBlock(addr, data, head);
+    addr += head; data += head; size -= head;
+
+    uint64_t count = size / width;
+    if(count > 0) {
+        words.assign(count, 0);
+        transfer(false, width, addr, words.data(), count);
+        for(uint64_t i = 0; i < count; i++)
+            memcpy(data + i * width, &words[i], width);
+    }
+
+    BaseTargetBus::readBlock(addr + count * width, data + count * width, size - count * width);
+}
+
+uint64_t Wishbone::busAddress(uint64_t addr)
+{
+    return addr >> (32 - addr_lines);
+}
+
+void Wishbone::setCycleType(WishboneCycleType type)
+{
+    if(wb_cti != nullptr)
+        *wb_cti = (uint8_t)type;
+    if(wb_bte != nullptr)
+        *wb_bte = (uint8_t)WishboneBurstType::LINEAR;
+}
+
+void Wishbone::transfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count)
+{
+    if(pipelined)
+        pipelinedTransfer(write, width, addr, values, count);
+    else
+        burstTransfer(write, width, addr, values, count);
+}
+
+void Wishbone::pipelinedTransfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count)
+{
+    uint64_t issued = 0;
+    uint64_t acked = 0;
+    int timeout = DEFAULT_TIMEOUT;
+
+    *wb_we = write;
+    *wb_sel = (uint8_t)((1 << width) - 1);
+    *wb_cyc = 1;
+
+    while(acked < count) {
+        if(issued < count) {
+            *wb_stb = 1;
+            *wb_addr = busAddress(addr + issued * width);
+            if(write)
+                *wb_wr_dat = values[issued];
+            if(count == 1)
+                setCycleType(WishboneCycleType::CLASSIC);
+            else
+                setCycleType(issued + 1 < count ? WishboneCycleType::INCREMENTING : WishboneCycleType::END);
+        }
+        else {
+            *wb_stb = 0;
+        }
+
+        // `wb_stall` may depend on the request combinationally
+        evaluateModel();
+        bool accepted = *wb_stb && !*wb_stall;
+        tick(true);
+        if(accepted)
+            issued++;
+
+        if(*wb_ack && acked < issued) {
+            if(!write)
+                values[acked] = *wb_rd_dat;
+            acked++;
+            timeout = DEFAULT_TIMEOUT;
+        }
+        else if(--timeout == 0) {
+            *wb_stb = 0;
+            *wb_cyc = 0;
+            throw "Operation timeout";
+        }
+    }
+
+    *wb_stb = 0;
+    *wb_cyc = 0;
+    *wb_we = 0;
+    *wb_sel = 0;
+}
+
+void Wishbone::burstTransfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count)
+{
+    *wb_we = write;
+    *wb_sel = (uint8_t)((1 << width) - 1);
+    *wb_cyc = 1;
+    *wb_stb = 1;
+
+    // With registered feedback the target acknowledges the next beat right away,
+    // so a burst of N beats takes N cycles plus the latency of the first one
+    for(uint64_t i = 0; i < count; i++) {
+        setCycleType(i + 1 < count ? WishboneCycleType::INCREMENTING : WishboneCycleType::END);
+        *wb_addr = busAddress(addr + i * width);
+        if(write)
+            *wb_wr_dat = values[i];
+
+        timeoutTick(wb_ack, 1);
+        if(!write)
+            values[i] = *wb_rd_dat;
+    }
+
+    *wb_stb = 0;
+    *wb_cyc = 0;
+    *wb_we = 0;
+    *wb_sel = 0;
+
+    timeoutTick(wb_ack, 0);
+}
+
 void Wishbone::reset()
 {
     *wb_rst = 1;
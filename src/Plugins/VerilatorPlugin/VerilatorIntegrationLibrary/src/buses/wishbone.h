@@ -6,8 +6,12 @@
 //
 #ifndef Wishbone_H
 #define Wishbone_H
+#include <vector>
 #include "bus.h"
 
+enum class WishboneCycleType  {CLASSIC = 0, CONSTANT = 1, INCREMENTING = 2, END = 7};
+enum class WishboneBurstType  {LINEAR = 0, WRAP4 = 1, WRAP8 = 2, WRAP16 = 3};
+
 class WishboneBase
 {
 public:
@@ -22,8 +26,16 @@ public:
     uint8_t  *wb_ack;
     uint8_t  *wb_cyc;
     uint8_t  *wb_stall;
+    uint8_t  *wb_cti = nullptr; // optional
+    uint8_t  *wb_bte = nullptr; // optional
     uint8_t   granularity;
     uint8_t   addr_lines;
+
+    // Wishbone B4 pipelined mode: a request is accepted on every edge with `wb_stall` low
+    // and acknowledged by a single-cycle `wb_ack` later on, so requests can be outstanding.
+    // Otherwise classic cycles are used; with `wb_cti` connected, block transfers
+    // become incrementing bursts (registered feedback).
+    bool      pipelined = false;
 };
 
 class Wishbone : public WishboneBase, public BaseTargetBus
@@ -32,7 +44,18 @@ public:
     virtual void tick(bool countEnable, uint64_t steps);
     virtual void write(int width, uint64_t addr, uint64_t value);
     virtual uint64_t read(int width, uint64_t addr);
+    void writeBlock(uint64_t addr, const uint8_t* data, uint64_t size) override;
+    void readBlock(uint64_t addr, uint8_t* data, uint64_t size) override;
     virtual void reset();
     void timeoutTick(uint8_t *signal, uint8_t value, int timeout);
+
+private:
+    uint64_t busAddress(uint64_t addr);
+    void setCycleType(WishboneCycleType type);
+    void transfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count);
+    void pipelinedTransfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count);
+    void burstTransfer(bool write, int width, uint64_t addr, uint64_t* values, uint64_t count);
+
+    std::vector<uint64_t> words;
 };
 #endif
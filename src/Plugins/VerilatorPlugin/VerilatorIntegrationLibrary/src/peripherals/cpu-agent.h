@@ -24,6 +24,7 @@ public:
 
     void tick(bool countEnable, uint64_t steps) override
     {
+        uint64_t started = statistics ? AgentStatistics::now() : 0;
         for (size_t i = 0; i < steps; i++)
         {
             for (auto &bus : initatorInterfaces)
@@ -38,9 +39,15 @@ public:
 
             for (auto &bus : initatorInterfaces)
                 bus->clearSignals();
+
+            quantumCycles++;
+            if (!interrupts.empty())
+                interrupts.sample(quantumCycles);
         }
         if (countEnable)
             tickCounter += steps;
+        if (statistics)
+            statistics->addCycles(steps, 0, 2 * steps, AgentStatistics::now() - started);
     }
 
     void handleRequest(Protocol *message) override
@@ -96,7 +103,8 @@ public:
                 }
             }
             ticks = ticks > 0 ? ticks : 0;
-            communicationChannel->sendSender(Protocol(tickClock, 0, ticks));
+            uint64_t activity = finishQuantum(message->value);
+            communicationChannel->sendSender(Protocol(tickClock, activity, ticks));
         }
         break;
 
@@ -132,7 +140,46 @@ public:
 
     void reset() override
     {
+        if (restoreResetSnapshot())
+            return;
         cpu->reset();
+        captureResetSnapshot();
+    }
+
+    // The debug program is rebuilt from the mode instead of being saved, state is only
+    // saved between requests, when no other program can be running
+    void serialize(StateWriter &state) override
+    {
+        RenodeAgent::serialize(state);
+        state.write(tickCounter);
+        state.write(debugProgramReadCount);
+        state.write(debugProgramReturnValue);
+        state.write(lastRequestAddress);
+        state.write(debugProgramReturnSuccess);
+        state.write(debugProgramReadLastInstruction);
+        state.write(wasHalted);
+        state.write(inDebugMode);
+        state.write(inSingleStepMode);
+        state.write(debugProgramOrPrefetch);
+    }
+
+    void deserialize(StateReader &state) override
+    {
+        RenodeAgent::deserialize(state);
+        state.read(tickCounter);
+        state.read(debugProgramReadCount);
+        state.read(debugProgramReturnValue);
+        state.read(lastRequestAddress);
+        state.read(debugProgramReturnSuccess);
+        state.read(debugProgramReadLastInstruction);
+        state.read(wasHalted);
+        state.read(inDebugMode);
+        state.read(inSingleStepMode);
+        state.read(debugProgramOrPrefetch);
+        if (inSingleStepMode)
+            debugProgram = cpu->getSingleStepModeProgram();
+        else
+            debugProgram = {};
     }
 
     uint64_t getRegister(uint64_t id)
@@ -219,6 +266,20 @@ public:
             debugProgramReturn(addr, value);
     }
 
+    void pushDoubleWordMaskedToAgent(uint64_t addr, uint32_t value, uint8_t mask) override
+    {
+        if (!inDebugMode)
+            RenodeAgent::pushDoubleWordMaskedToAgent(addr, value, mask);
+        else
+        {
+            for (size_t i = 0; i < 4; i++)
+            {
+                if ((mask & (1 << i)) == 0)
+                    ((uint8_t *)&value)[i] = 0;
+            }
+            debugProgramReturn(addr, value);
+        }
+    }
 
     uint64_t requestDoubleWordFromAgent(uint64_t addr) override
     {
@@ -14,23 +14,18 @@ UART::UART(BaseTargetBus* bus, uint8_t* txd, uint8_t* rxd, uint32_t prescaler, u
 
     this->prescaler = prescaler;
     this->tx_reg_addr = tx_reg_addr;
-    this->prev_irq = 0;
+
+    // The irq is sampled by the agent every cycle and reported as interrupt 1
+    if (irq != nullptr) {
+        registerInterrupt(irq, 1);
+    }
 
     // Set rxd line idle state
     *this->rxd = 1;
 }
 
 void UART::eval() {
-    if (irq != nullptr) {
-        if (*irq == 1 && prev_irq == 0) {
-            communicationChannel->sendSender(Protocol(interrupt, 1, 1));
-        }
-
-        if (*irq == 0 && prev_irq == 1) {
-            communicationChannel->sendSender(Protocol(interrupt, 1, 0));
-        }
-        prev_irq = *irq;
-    }
+    // Kept for the models calling it on every evaluation, the irq is sampled while ticking
 }
 
 void UART::Txd() {
@@ -42,7 +37,7 @@ void UART::Txd() {
         tick(true, prescaler * 8);
     }
     tick(true, prescaler * 8);
-    communicationChannel->sendSender(Protocol(txdRequest, 0, buffer.to_ulong()));
+    sendEvent(Protocol(txdRequest, 0, buffer.to_ulong()));
 }
 
 void UART::Rxd(uint8_t value) {
@@ -24,7 +24,6 @@ struct UART : RenodeAgent
     uint8_t* irq;
     uint32_t prescaler;
     uint32_t tx_reg_addr;
-    uint8_t prev_irq;
 
     private:
     void writeToBus(int width, uint64_t addr, uint64_t value) override;
@@ -8,7 +8,13 @@
 #define RENODE_H
 #include <string.h>
 #include <stdlib.h>
+// RENODE_IMPORTS may name another header defining EXTERNAL_AS, e.g. stubs of the imports
+// for building parts of the library without the Renode tree
+#ifdef RENODE_IMPORTS
+#include RENODE_IMPORTS
+#else
 #include "../../../../Infrastructure/src/Emulator/Cores/renode/include/renode_imports.h"
+#endif
 
 // Protocol must be in sync with Renode's ProtocolMessage
 #pragma pack(push, 1)
@@ -61,9 +67,71 @@ enum Action
   writeRequestWord = 26,
   writeRequestDoubleWord = 27,
   writeRequestQuadWord = 28,
+  batch = 29,
+  writeRequestBlock = 30,
+  readRequestBlock = 31,
+  blockData = 32,
+  getBlock = 33,
+  pushBlock = 34,
+  registerCacheableRegion = 35,
+  invalidateCachedRange = 36,
+  registerSharedMemory = 37,
+  pushDoubleWordMasked = 38,
+  selectInstance = 39,
+  enableStatistics = 40,
+  getStatistics = 41,
+  cycleOffset = 42,
+  saveState = 43,
+  loadState = 44,
   step = 100,
 };
 
+// ProtocolExtension must be in sync with Renode's ProtocolExtensions.
+// Renode sends a mask of the extensions it supports in the handshake request
+// and the agent responds with the subset it's going to use.
+enum ProtocolExtension
+{
+  batchedFrames = 1 << 0,
+  // Renode doesn't wait for the response to write requests; the agent executes them
+  // in order and reports failures with an error message on the sender channel.
+  postedWrites = 1 << 1,
+  // Messages sent by the agent on its own (pushes, memory requests, interrupts and the like)
+  // are timestamped with cycleOffset messages.
+  cycleOffsets = 1 << 2,
+  // The response to tickClock carries in addr the activity in the quantum, see below.
+  activityReports = 1 << 3,
+};
+
+// Block transfers: a writeRequestBlock/readRequestBlock/getBlock/pushBlock message carries the address
+// and the size of the block in bytes. The data follows it as blockData messages
+// carrying BLOCK_DATA_SIZE bytes each (little-endian, first in addr, then in value);
+// the last one is padded with zeros. The response to getBlock consists of the data only.
+#define BLOCK_DATA_SIZE 16
+
+// pushDoubleWordMasked carries the double word in the lower half of value and the mask
+// of bytes to be written in bits 32-35, the other bytes are left untouched.
+#define PUSH_MASK_SHIFT 32
+
+// registerSharedMemory carries the guest address in addr and the size of its block in value.
+// The block is a SharedMemoryMapping followed by the path of the file backing the memory
+// (e.g. /proc/<pid>/fd/<fd> or a file in /dev/shm), terminated with a zero byte.
+struct SharedMemoryMapping
+{
+  uint64_t size;
+  uint64_t offset;
+};
+
+// enableStatistics turns the agent's instrumentation on (value != 0, clearing what was gathered
+// so far) or off. getStatistics makes the agent log a report of the gathered statistics.
+
+// cycleOffset carries in value the number of cycles simulated since the end of the last tickClock
+// quantum when the events reported by the following messages on the sender channel happened.
+// It applies until the next cycleOffset or the end of the quantum, so it's only sent when it changes.
+
+// The activity reported in the response to tickClock is the number of bus accesses requested
+// by Renode and of messages sent by the agent on its own (pushes, memory requests, interrupt
+// edges and the like) since the previous response. Renode uses it to adjust the quantum.
+
 enum LogLevel
 {
   LOG_LEVEL_NOISY   = -1,
@@ -5,10 +5,28 @@
 // Full license text is available in 'licenses/MIT.txt'.
 //
 #include "renode_bus.h"
-static RenodeAgent* renodeAgent;
+#include <algorithm>
+#include <cinttypes>
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+// Agents created by initialize_native, indexed by their instance numbers (null once disconnected),
+// and the one selected by Renode
+static std::vector<RenodeAgent*> nativeAgents;
+static RenodeAgent* selectedAgent;
 
 #define IO_THREADS 1
 
+// Bumped whenever the layout of the agent's state changes
+#define AGENT_STATE_MAGIC 0x54535241 // "ARST"
+#define AGENT_STATE_VERSION 1
+
 //=================================================
 // RenodeAgent
 //=================================================
@@ -19,6 +37,8 @@ RenodeAgent::RenodeAgent(BaseTargetBus* bus)
     targetInterfaces[0]->tickCounter = 0;
     firstInterface = bus;
     bus->setAgent(this);
+    if(AGENT_STATISTICS)
+        statistics.reset(new AgentStatistics());
 }
 
 RenodeAgent::RenodeAgent(BaseInitiatorBus* bus)
@@ -27,34 +47,40 @@ RenodeAgent::RenodeAgent(BaseInitiatorBus* bus)
     initatorInterfaces[0]->tickCounter = 0;
     firstInterface = bus;
     bus->setAgent(this);
+    if(AGENT_STATISTICS)
+        statistics.reset(new AgentStatistics());
 }
 
 void RenodeAgent::addBus(BaseTargetBus* bus)
 {
     targetInterfaces.push_back(std::unique_ptr<BaseTargetBus>(bus));
     bus->setAgent(this);
+    updateCycleNotifications();
 }
 
 void RenodeAgent::addBus(BaseInitiatorBus* bus)
 {
     initatorInterfaces.push_back(std::unique_ptr<BaseInitiatorBus>(bus));
     bus->setAgent(this);
+    updateCycleNotifications();
 }
 
 void RenodeAgent::writeToBus(int width, uint64_t addr, uint64_t value)
 {
+    quantumActivity++;
     try {
         targetInterfaces[0]->write(width, addr, value);
-        communicationChannel->sendMain(Protocol(ok, 0, 0));
+        writeCompleted(true, addr);
     }
     catch(const char* msg) {
         log(LOG_LEVEL_ERROR, msg);
-        communicationChannel->sendMain(Protocol(error, 0, 0));
+        writeCompleted(false, addr);
     }
 }
 
 void RenodeAgent::readFromBus(int width, uint64_t addr)
 {
+    quantumActivity++;
     try {
         uint64_t readValue = targetInterfaces[0]->read(width, addr);
         communicationChannel->sendMain(Protocol(readRequest, addr, readValue));
@@ -65,304 +91,1896 @@ void RenodeAgent::readFromBus(int width, uint64_t addr)
     }
 }
 
+void RenodeAgent::writeBlockToBus(uint64_t addr, uint64_t size)
+{
+    quantumActivity++;
+    try {
+        blockBuffer.resize(size);
+        receiveBlock(blockBuffer.data(), size);
+        targetInterfaces[0]->writeBlock(addr, blockBuffer.data(), size);
+        writeCompleted(true, addr);
+    }
+    catch(const char* msg) {
+        log(LOG_LEVEL_ERROR, msg);
+        writeCompleted(false, addr);
+    }
+}
+
+void RenodeAgent::writeCompleted(bool success, uint64_t addr)
+{
+    if(!communicationChannel->usesExtension(postedWrites)) {
+        communicationChannel->sendMain(Protocol(success ? ok : error, 0, 0));
+    }
+    else if(!success) {
+        // Renode has already moved on, so the failure is reported asynchronously
+        communicationChannel->sendSender(Protocol(error, addr, 0));
+    }
+}
+
+void RenodeAgent::readBlockFromBus(uint64_t addr, uint64_t size)
+{
+    quantumActivity++;
+    try {
+        blockBuffer.resize(size);
+        targetInterfaces[0]->readBlock(addr, blockBuffer.data(), size);
+    }
+    catch(const char* msg) {
+        log(LOG_LEVEL_ERROR, msg);
+        communicationChannel->sendMain(Protocol(error, 0, 0));
+        return;
+    }
+    communicationChannel->sendMain(Protocol(readRequestBlock, addr, size));
+    sendBlock(true, blockBuffer.data(), size);
+}
+
+void RenodeAgent::receiveBlock(uint8_t* data, uint64_t size)
+{
+    Protocol record;
+    bool malformed = false;
+    for(uint64_t offset = 0; offset < size; offset += BLOCK_DATA_SIZE) {
+        receive(&record);
+        // Receive the whole block even if it's malformed to stay in sync with Renode
+        if(record.actionId != blockData) {
+            malformed = true;
+            continue;
+        }
+        uint64_t words[] = {record.addr, record.value};
+        memcpy(data + offset, words, std::min<uint64_t>(BLOCK_DATA_SIZE, size - offset));
+    }
+
+    if(malformed) {
+        throw "Malformed block transfer";
+    }
+}
+
+void RenodeAgent::sendBlock(bool mainChannel, const uint8_t* data, uint64_t size)
+{
+    for(uint64_t offset = 0; offset < size; offset += BLOCK_DATA_SIZE) {
+        uint64_t words[] = {0, 0};
+        memcpy(words, data + offset, std::min<uint64_t>(BLOCK_DATA_SIZE, size - offset));
+        if(mainChannel)
+            communicationChannel->sendMain(Protocol(blockData, words[0], words[1]));
+        else
+            communicationChannel->sendSender(Protocol(blockData, words[0], words[1]));
+    }
+}
+
 void RenodeAgent::pushByteToAgent(uint64_t addr, uint8_t value)
 {
-    communicationChannel->sendSender(Protocol(pushByte, addr, value));
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(value))) {
+        *memory = value;
+        return;
+    }
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushByte);
+    writeCached(addr, &value, sizeof(value));
+    sendEvent(Protocol(pushByte, addr, value));
 }
 
 void RenodeAgent::pushWordToAgent(uint64_t addr, uint16_t value)
 {
-    communicationChannel->sendSender(Protocol(pushWord, addr, value));
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(value))) {
+        memcpy(memory, &value, sizeof(value));
+        return;
+    }
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushWord);
+    writeCached(addr, (uint8_t*)&value, sizeof(value));
+    sendEvent(Protocol(pushWord, addr, value));
 }
 
 void RenodeAgent::pushDoubleWordToAgent(uint64_t addr, uint32_t value)
 {
-    communicationChannel->sendSender(Protocol(pushDoubleWord, addr, value));
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(value))) {
+        memcpy(memory, &value, sizeof(value));
+        return;
+    }
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushDoubleWord);
+    writeCached(addr, (uint8_t*)&value, sizeof(value));
+    sendEvent(Protocol(pushDoubleWord, addr, value));
+}
+
+void RenodeAgent::pushDoubleWordMaskedToAgent(uint64_t addr, uint32_t value, uint8_t mask)
+{
+    mask &= 0xF;
+    if(mask == 0)
+        return;
+
+    uint8_t* bytes = (uint8_t*)&value;
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(value))) {
+        for(int i = 0; i < 4; i++) {
+            if(mask & (1 << i))
+                memory[i] = bytes[i];
+        }
+        return;
+    }
+
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushDoubleWordMasked);
+    for(int i = 0; i < 4; i++) {
+        if(mask & (1 << i))
+            writeCached(addr + i, bytes + i, 1);
+    }
+    sendEvent(Protocol(pushDoubleWordMasked, addr, value | ((uint64_t)mask << PUSH_MASK_SHIFT)));
+}
+
+uint64_t RenodeAgent::requestByteFromAgent(uint64_t addr)
+{
+    return requestValue(getByte, addr, sizeof(uint8_t));
+}
+
+uint64_t RenodeAgent::requestWordFromAgent(uint64_t addr)
+{
+    return requestValue(getWord, addr, sizeof(uint16_t));
 }
 
 uint64_t RenodeAgent::requestDoubleWordFromAgent(uint64_t addr)
 {
-    communicationChannel->sendSender(Protocol(getDoubleWord, addr, 0));
-    Protocol* received = communicationChannel->receive();
-    while (received->actionId != writeRequest)
+    return requestValue(getDoubleWord, addr, sizeof(uint32_t));
+}
+
+uint64_t RenodeAgent::requestValue(int action, uint64_t addr, uint64_t size)
+{
+    uint64_t value = 0;
+    if(uint8_t* memory = sharedMemoryPointer(addr, size)) {
+        memcpy(&value, memory, size);
+        return value;
+    }
+
+    auto lock = lockChannel();
+    if(readCached(addr, (uint8_t*)&value, size))
+        return value;
+
+    Protocol received;
+    uint64_t started = statistics ? AgentStatistics::now() : 0;
+    sendEvent(Protocol(action, addr, 0));
+    communicationChannel->receive(&received);
+    while (received.actionId != writeRequest)
     {
-        handleRequest(received);
-        delete received;
-        received = communicationChannel->receive();
+        dispatchRequest(&received);
+        communicationChannel->receive(&received);
     }
-    auto result = received->value;
-    delete received;
-    return result;
+    if(statistics)
+        statistics->record(action, AgentStatistics::now() - started);
+    return received.value;
 }
 
 void RenodeAgent::pushToAgent(uint64_t addr, uint64_t value)
 {
-    communicationChannel->sendSender(Protocol(pushDoubleWord, addr, value));
+    uint32_t doubleWord = value;
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(doubleWord))) {
+        memcpy(memory, &doubleWord, sizeof(doubleWord));
+        return;
+    }
+
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushDoubleWord);
+    writeCached(addr, (uint8_t*)&doubleWord, sizeof(doubleWord));
+    sendEvent(Protocol(pushDoubleWord, addr, value));
 }
 
 uint64_t RenodeAgent::requestFromAgent(uint64_t addr)
 {
-    communicationChannel->sendSender(Protocol(getDoubleWord, addr, 0));
-    Protocol* received = communicationChannel->receive();
-    return received->value;
+    uint32_t value;
+    if(uint8_t* memory = sharedMemoryPointer(addr, sizeof(value))) {
+        memcpy(&value, memory, sizeof(value));
+        return value;
+    }
+
+    auto lock = lockChannel();
+    if(readCached(addr, (uint8_t*)&value, sizeof(value)))
+        return value;
+
+    Protocol received;
+    uint64_t started = statistics ? AgentStatistics::now() : 0;
+    sendEvent(Protocol(getDoubleWord, addr, 0));
+    communicationChannel->receive(&received);
+    if(statistics)
+        statistics->record(getDoubleWord, AgentStatistics::now() - started);
+    return received.value;
 }
 
-void RenodeAgent::tick(bool countEnable, uint64_t steps)
+void RenodeAgent::pushBlockToAgent(uint64_t addr, const uint8_t* data, uint64_t size)
 {
-    for(auto& b : targetInterfaces)
-        b->tick(countEnable, steps);
-    for(auto& b : initatorInterfaces)
-        b->tick(countEnable, steps);
+    if(uint8_t* memory = sharedMemoryPointer(addr, size)) {
+        memcpy(memory, data, size);
+        return;
+    }
+    auto lock = lockChannel();
+    if(statistics)
+        statistics->count(pushBlock);
+    writeCached(addr, data, size);
+    sendEvent(Protocol(pushBlock, addr, size));
+    sendBlock(false, data, size);
 }
 
-void RenodeAgent::timeoutTick(uint8_t* signal, uint8_t expectedValue, int timeout)
+void RenodeAgent::requestBlockFromAgent(uint64_t addr, uint8_t* data, uint64_t size)
 {
-    for(auto& b : targetInterfaces)
-        b->timeoutTick(signal, expectedValue, timeout);
-    for(auto& b : initatorInterfaces)
-        b->timeoutTick(signal, expectedValue, timeout);
+    if(uint8_t* memory = sharedMemoryPointer(addr, size)) {
+        memcpy(data, memory, size);
+        return;
+    }
+    auto lock = lockChannel();
+    if(readCached(addr, data, size))
+        return;
+
+    uint64_t started = statistics ? AgentStatistics::now() : 0;
+    sendEvent(Protocol(getBlock, addr, size));
+    receiveBlock(data, size);
+    if(statistics)
+        statistics->record(getBlock, AgentStatistics::now() - started);
 }
 
-void RenodeAgent::reset()
+RenodeAgent::~RenodeAgent()
 {
-    for(auto& b : targetInterfaces)
-        b->reset();
-    for(auto& b : initatorInterfaces)
-        b->reset();
+#ifdef __linux__
+    for(auto& region : sharedMemoryRegions)
+        munmap(region.mapping, region.mappingSize);
+#endif
 }
 
-void RenodeAgent::handleCustomRequestType(Protocol* message)
+void RenodeAgent::mapSharedMemory(uint64_t addr, uint64_t size, const char* path, uint64_t offset)
 {
-    log(LOG_LEVEL_WARNING, "Unhandled request type: %d", message->actionId);
+#ifdef __linux__
+    if(size == 0 || addr + size < addr) {
+        throw "Invalid shared memory region";
+    }
+
+    int fd = open(path, O_RDWR);
+    if(fd < 0) {
+        throw "Unable to open the shared memory file";
+    }
+
+    // mmap requires a page-aligned offset
+    uint64_t pageOffset = offset % sysconf(_SC_PAGESIZE);
+    void* mapping = mmap(nullptr, size + pageOffset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset - pageOffset);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        throw "Unable to map the shared memory file";
+    }
+
+    sharedMemoryRegions.push_back({addr, size, (uint8_t*)mapping + pageOffset, mapping, size + pageOffset});
+#else
+    throw "Shared memory mapping is only supported on Linux";
+#endif
 }
 
-void RenodeAgent::log(int level, const char* fmt, ...)
+void RenodeAgent::mapSharedMemoryFromRenode(uint64_t addr, uint64_t size)
 {
-    char s[1024];
-    va_list ap;
-    va_start(ap, fmt);
-    vsnprintf(s, 1024, fmt, ap);
-    communicationChannel->log(level, s);
-    va_end(ap);
+    try {
+        blockBuffer.resize(size + 1);
+        receiveBlock(blockBuffer.data(), size);
+        blockBuffer[size] = 0;
+        if(size <= sizeof(SharedMemoryMapping)) {
+            throw "Malformed shared memory mapping";
+        }
+
+        SharedMemoryMapping mapping;
+        memcpy(&mapping, blockBuffer.data(), sizeof(mapping));
+        mapSharedMemory(addr, mapping.size, (const char*)blockBuffer.data() + sizeof(mapping), mapping.offset);
+        communicationChannel->sendMain(Protocol(ok, 0, 0));
+    }
+    catch(const char* msg) {
+        log(LOG_LEVEL_ERROR, msg);
+        communicationChannel->sendMain(Protocol(error, 0, 0));
+    }
 }
 
-Protocol* RenodeAgent::receive()
+bool RenodeAgent::isMemoryBacked(uint64_t addr, uint64_t size)
 {
-    return communicationChannel->receive();
+    return sharedMemoryPointer(addr, size) != nullptr || findCacheableRegion(addr, size) != nullptr;
 }
 
-void RenodeAgent::registerInterrupt(uint8_t *irq, uint8_t irq_addr)
+uint8_t* RenodeAgent::sharedMemoryPointer(uint64_t addr, uint64_t size)
 {
-    if (irq == nullptr) {
-        log(LOG_LEVEL_ERROR, "The irq address cannot be null");
-        communicationChannel->sendMain(Protocol(error, 0, 0));
+    for(auto& region : sharedMemoryRegions) {
+        if(addr >= region.start && size <= region.size && addr - region.start <= region.size - size)
+            return region.data + (addr - region.start);
+    }
+    return nullptr;
+}
+
+void RenodeAgent::addCacheableRegion(uint64_t addr, uint64_t size)
+{
+    if(size == 0 || addr + size < addr) {
+        log(LOG_LEVEL_ERROR, "Invalid cacheable region: 0x%" PRIX64 ", size: 0x%" PRIX64, addr, size);
         return;
     }
 
-    interrupts.push_back({irq, 0, irq_addr});
+    // The shadow isn't initialized, so only the pages of lines actually fetched get allocated
+    CacheableRegion region;
+    region.start = addr;
+    region.size = size;
+    region.data.reset(new uint8_t[size]);
+    region.validLines.resize((size + AGENT_CACHE_LINE_SIZE - 1) / AGENT_CACHE_LINE_SIZE, false);
+    cacheableRegions.push_back(std::move(region));
 }
 
-void RenodeAgent::handleInterrupts(void)
+void RenodeAgent::invalidateCache(uint64_t addr, uint64_t size)
 {
-    for (unsigned long i = 0; i < interrupts.size(); i++) {
-        if (*interrupts[i].irq != interrupts[i].prev_irq) {
-            communicationChannel->sendSender(Protocol(interrupt, interrupts[i].irq_addr, *interrupts[i].irq));
-            interrupts[i].prev_irq = *interrupts[i].irq;
-        }
+    uint64_t end = size > UINT64_MAX - addr ? UINT64_MAX : addr + size;
+    for(auto& region : cacheableRegions) {
+        uint64_t first = std::max(addr, region.start);
+        uint64_t last = std::min(end, region.start + region.size);
+        if(first >= last)
+            continue;
+        first = (first - region.start) / AGENT_CACHE_LINE_SIZE;
+        last = (last - region.start - 1) / AGENT_CACHE_LINE_SIZE;
+        std::fill(region.validLines.begin() + first, region.validLines.begin() + last + 1, false);
     }
 }
 
-void RenodeAgent::simulate(int receiverPort, int senderPort, const char* address)
+RenodeAgent::CacheableRegion* RenodeAgent::findCacheableRegion(uint64_t addr, uint64_t size)
 {
-    renodeAgent = this;
-    SocketCommunicationChannel* channel = new SocketCommunicationChannel();
-    communicationChannel = channel;
-    channel->connect(receiverPort, senderPort, address);
-    Protocol* result;
-    reset();
-
-    while(channel->isConnected) {
-        result = receive();
-        handleRequest(result);
-        delete result;
+    for(auto& region : cacheableRegions) {
+        if(addr >= region.start && size <= region.size && addr - region.start <= region.size - size)
+            return &region;
     }
+    return nullptr;
 }
 
-void RenodeAgent::handleRequest(Protocol* request)
+bool RenodeAgent::readCached(uint64_t addr, uint8_t* data, uint64_t size)
 {
-    switch(request->actionId) {
-        case invalidAction:
-            break;
-        case tickClock:
-        {
-            long ticks = request->value - firstInterface->tickCounter;
-            if(ticks < 0) {
-                firstInterface->tickCounter -= request->value;
-            }
-            else {
-                tick(false, ticks);
-            }
-            firstInterface->tickCounter = 0;
-            communicationChannel->sendSender(Protocol(tickClock, 0, 0));
-        }
-            break;
-        case writeRequestByte:
-            writeToBus(1, request->addr, request->value);
-            break;
-        case writeRequestWord:
-            writeToBus(2, request->addr, request->value);
-            break;
-        case writeRequest: // due to historical reasons, writeRequest defaults to 32bits
-        case writeRequestDoubleWord:
-            writeToBus(4, request->addr, request->value);
-            break;
-        case writeRequestQuadWord:
-            writeToBus(8, request->addr, request->value);
-            break;
-        case readRequestByte:
-            readFromBus(1, request->addr);
-            break;
-        case readRequestWord:
-            readFromBus(2, request->addr);
-            break;
-        case readRequest: // due to historical reasons, writeRequest defaults to 32bits
-        case readRequestDoubleWord:
-            readFromBus(4, request->addr);
-            break;
-        case readRequestQuadWord:
-            readFromBus(8, request->addr);
-            break;
-        case resetPeripheral:
-            reset();
-            break;
-        case disconnect:
-        {
-            SocketCommunicationChannel* channel;
-            if((channel = dynamic_cast<SocketCommunicationChannel*>(communicationChannel)) != nullptr) {
-                communicationChannel->sendSender(Protocol(ok, 0, 0));
-                channel->isConnected = false;
-            }
-            break;
-        }
-        default:
-            handleCustomRequestType(request);
-            break;
+    if(size == 0)
+        return false;
+    CacheableRegion* region = findCacheableRegion(addr, size);
+    if(region == nullptr)
+        return false;
+
+    uint64_t offset = addr - region->start;
+    for(uint64_t line = offset / AGENT_CACHE_LINE_SIZE; line <= (offset + size - 1) / AGENT_CACHE_LINE_SIZE; line++) {
+        if(region->validLines[line])
+            continue;
+
+        uint64_t lineOffset = line * AGENT_CACHE_LINE_SIZE;
+        uint64_t lineSize = std::min<uint64_t>(AGENT_CACHE_LINE_SIZE, region->size - lineOffset);
+        uint64_t started = statistics ? AgentStatistics::now() : 0;
+        sendEvent(Protocol(getBlock, region->start + lineOffset, lineSize));
+        receiveBlock(region->data.get() + lineOffset, lineSize);
+        if(statistics)
+            statistics->record(getBlock, AgentStatistics::now() - started);
+        region->validLines[line] = true;
     }
+    memcpy(data, region->data.get() + offset, size);
+    return true;
 }
 
-//=================================================
-// SocketCommunicationChannel
-//=================================================
+void RenodeAgent::writeCached(uint64_t addr, const uint8_t* data, uint64_t size)
+{
+    // Write-through: Renode gets the data anyway, only the shadow has to be kept coherent
+    for(auto& region : cacheableRegions) {
+        uint64_t first = std::max(addr, region.start);
+        uint64_t last = std::min(addr + size, region.start + region.size);
+        if(first < last)
+            memcpy(region.data.get() + (first - region.start), data + (first - addr), last - first);
+    }
+}
 
-SocketCommunicationChannel::SocketCommunicationChannel()
+void RenodeAgent::tick(bool countEnable, uint64_t steps)
 {
-    ASocket::SettingsFlag dontLog = ASocket::NO_FLAGS;
-    mainSocket.reset(new CTCPClient(NULL, dontLog));
-    senderSocket.reset(new CTCPClient(NULL, dontLog));
+    if(statistics) {
+        uint64_t started = AgentStatistics::now();
+        uint64_t skipped = skippedCycles;
+        tickIdle(countEnable, steps);
+        skipped = skippedCycles - skipped;
+        // Every bus evaluates the model on both clock edges, evaluations made by the buses
+        // while setting signals aren't counted
+        uint64_t evaluations = 2 * (steps - skipped) * (targetInterfaces.size() + initatorInterfaces.size());
+        statistics->addCycles(steps - skipped, skipped, evaluations, AgentStatistics::now() - started);
+        return;
+    }
+    tickIdle(countEnable, steps);
 }
 
-void SocketCommunicationChannel::sendMain(const Protocol message)
+void RenodeAgent::tickIdle(bool countEnable, uint64_t steps)
 {
-    try {
-        mainSocket->Send((char *)&message, sizeof(struct Protocol));
+    if(!idlePredicate && idleSignals.empty()) {
+        tickBuses(countEnable, steps);
+        return;
     }
-    catch(const char* msg) {
-        isConnected = false;
-        throw msg;
+
+    while(steps > 0) {
+        if(isIdle()) {
+            skipCycles(countEnable, steps);
+            return;
+        }
+        uint64_t slice = std::min(steps, idleCheckInterval);
+        tickBuses(countEnable, slice);
+        steps -= slice;
     }
 }
 
-void SocketCommunicationChannel::sendSender(const Protocol message)
+void RenodeAgent::tickBuses(bool countEnable, uint64_t steps)
 {
-    try {
-        senderSocket->Send((char *)&message, sizeof(struct Protocol));
-    }
-    catch(const char* msg) {
-        isConnected = false;
-        throw msg;
+    if(tickPool) {
+        partitionCountEnable = countEnable;
+        while(steps > 0) {
+            partitionSteps = std::min(steps, tickLookahead);
+            tickPool->run();
+            quantumCycles += partitionSteps;
+            // Buses ticked in parallel don't notify about their cycles
+            if(!interrupts.empty())
+                interrupts.sample(quantumCycles);
+            steps -= partitionSteps;
+        }
+        return;
     }
+
+    // Buses notifying about their cycles advance quantumCycles on their own, up to the end of
+    // this tick. The buses ticked after the first one simulate the same cycles again, their events
+    // are timestamped with the end of the tick, so that the timestamps never go back.
+    tickEnd = quantumCycles + steps;
+    for(auto& b : targetInterfaces)
+        b->tick(countEnable, steps);
+    for(auto& b : initatorInterfaces)
+        b->tick(countEnable, steps);
+    quantumCycles = tickEnd;
+    tickEnd = UINT64_MAX;
 }
 
-void SocketCommunicationChannel::log(int logLevel, const char* data)
+// Called whenever the conditions change (buses, interrupts, the connection and its extensions),
+// so that the cycles simulated by the accesses of Renode are followed as well as the ticks
+void RenodeAgent::updateCycleNotifications()
 {
-    sendSender(Protocol(logMessage, strlen(data), logLevel));
-    senderSocket->Send(data, strlen(data));
+    // Only needed if the interrupt lines are sampled or the events are timestamped
+    bool enabled = !tickPool && (!interrupts.empty()
+        || (communicationChannel != nullptr && communicationChannel->usesExtension(cycleOffsets)));
+    auto onCycle = enabled ? &RenodeAgent::cycleTicked : nullptr;
+    for(auto& b : targetInterfaces)
+        b->onCycle = onCycle;
+    for(auto& b : initatorInterfaces)
+        b->onCycle = onCycle;
 }
 
-Protocol* SocketCommunicationChannel::receive()
+void RenodeAgent::cycleTicked(RenodeAgent* agent)
 {
-    Protocol* message = new Protocol;
-    mainSocket->CTCPClient::Receive((char *)message,  sizeof(Protocol));
-    return message;
+    if(agent->quantumCycles < agent->tickEnd)
+        agent->quantumCycles++;
+    if(!agent->interrupts.empty())
+        agent->interrupts.sample(agent->quantumCycles);
 }
 
-void SocketCommunicationChannel::connect(int receiverPort, int senderPort, const char* address)
+bool RenodeAgent::isIdle()
 {
-    mainSocket->Connect(address, std::to_string(receiverPort));
-    senderSocket->Connect(address, std::to_string(senderPort));
-    handshakeValid();
+    for(auto& s : idleSignals) {
+        if(*s.signal != s.idleValue)
+            return false;
+    }
+    return !idlePredicate || idlePredicate();
 }
 
-void SocketCommunicationChannel::handshakeValid()
+void RenodeAgent::skipCycles(bool countEnable, uint64_t steps)
 {
-    Protocol* received = receive();
-    if(received->actionId == handshake) {
-        sendMain(Protocol(handshake, 0, 0));
-        isConnected = true;
+    // Skipped cycles are accounted for as if they were simulated
+    if(countEnable) {
+        for(auto& b : targetInterfaces)
+            b->tickCounter += steps;
+        for(auto& b : initatorInterfaces)
+            b->tickCounter += steps;
     }
+    skippedCycles += steps;
+    quantumCycles += steps;
 }
 
-//=================================================
-// NativeCommunicationChannel
-//=================================================
+void RenodeAgent::setIdlePredicate(std::function<bool()> predicate)
+{
+    idlePredicate = predicate;
+}
 
-extern void handleMainMessage(void* ptr);
-extern void handleSenderMessage(void* ptr);
-extern void receive(void* ptr);
+void RenodeAgent::addIdleSignal(uint8_t* signal, uint8_t idleValue)
+{
+    if (signal == nullptr) {
+        log(LOG_LEVEL_ERROR, "The idle signal address cannot be null");
+        return;
+    }
 
-EXTERNAL_AS(action_intptr, HandleMainMessage, handleMainMessage);
-EXTERNAL_AS(action_intptr, HandleSenderMessage, handleSenderMessage);
-EXTERNAL_AS(action_intptr, Receive, receive);
+    idleSignals.push_back({signal, idleValue});
+}
 
-void NativeCommunicationChannel::sendMain(const Protocol message)
+void RenodeAgent::setIdleCheckInterval(uint64_t cycles)
 {
-    handleMainMessage(new Protocol(message));
+    idleCheckInterval = cycles > 0 ? cycles : 1;
 }
 
-void NativeCommunicationChannel::sendSender(const Protocol message)
+void RenodeAgent::tickPartition(unsigned index)
 {
-    handleSenderMessage(new Protocol(message));
+    size_t targets = targetInterfaces.size();
+    size_t count = targets + initatorInterfaces.size();
+    for(size_t i = index; i < count; i += tickThreads) {
+        if(i < targets)
+            targetInterfaces[i]->tick(partitionCountEnable, partitionSteps);
+        else
+            initatorInterfaces[i - targets]->tick(partitionCountEnable, partitionSteps);
+    }
 }
 
-void NativeCommunicationChannel::log(int logLevel, const char* data)
+void RenodeAgent::setParallelTick(unsigned threads, uint64_t lookahead)
 {
-    handleSenderMessage(new Protocol(logMessage, strlen(data) + 1, (uint64_t)data));
-    handleSenderMessage(new Protocol(logMessage, 0, logLevel));
+    tickPool.reset();
+    tickThreads = threads > 1 ? threads : 1;
+    tickLookahead = lookahead > 0 ? lookahead : 1;
+    if(tickThreads > 1)
+        tickPool.reset(new TickWorkerPool(tickThreads, [this](unsigned index) { tickPartition(index); }));
+    updateCycleNotifications();
 }
 
-Protocol* NativeCommunicationChannel::receive()
+std::unique_lock<std::recursive_mutex> RenodeAgent::lockChannel()
 {
-    Protocol* message = new Protocol;
-    ::receive(message);
-    return message;
+    // Buses ticked in parallel share the communication channel
+    if(tickPool)
+        return std::unique_lock<std::recursive_mutex>(channelMutex);
+    return std::unique_lock<std::recursive_mutex>(channelMutex, std::defer_lock);
 }
 
-//=================================================
-// Functions exported to Renode
-//=================================================
+void RenodeAgent::timeoutTick(uint8_t* signal, uint8_t expectedValue, int timeout)
+{
+    for(auto& b : targetInterfaces)
+        b->timeoutTick(signal, expectedValue, timeout);
+    for(auto& b : initatorInterfaces)
+        b->timeoutTick(signal, expectedValue, timeout);
+}
 
-void initialize_native()
+void RenodeAgent::reset()
 {
-    renodeAgent = Init();
-    renodeAgent->communicationChannel = new NativeCommunicationChannel();
+    // Renode resets after connecting too, which may have enabled the timestamps
+    updateCycleNotifications();
+    if(!restoreResetSnapshot()) {
+        for(auto& b : targetInterfaces)
+            b->reset();
+        for(auto& b : initatorInterfaces)
+            b->reset();
+        captureResetSnapshot();
+    }
+
+    // Renode starts a new quantum, with the lines as the reset left them
+    quantumCycles = 0;
+    timestampedCycle = UINT64_MAX;
+    if(!interrupts.empty())
+        interrupts.sample(quantumCycles);
 }
 
-void handle_request(Protocol* request)
+void RenodeAgent::setFastReset(bool enabled)
 {
-    renodeAgent->handleRequest(request);
+    fastReset = enabled;
+    resetSnapshot.clear();
+}
+
+void RenodeAgent::addSnapshotRegion(void* data, size_t size)
+{
+    if(data == nullptr) {
+        log(LOG_LEVEL_ERROR, "The snapshot region address cannot be null");
+        return;
+    }
+
+    snapshotRegions.push_back({data, size});
+    resetSnapshot.clear();
+}
+
+void RenodeAgent::captureResetSnapshot()
+{
+    if(!fastReset)
+        return;
+
+    resetSnapshot.clear();
+    StateWriter state(resetSnapshot);
+    for(auto& region : snapshotRegions)
+        state.write(region.data, region.size);
+    for(auto& b : targetInterfaces)
+        b->saveState(state);
+    for(auto& b : initatorInterfaces)
+        b->saveState(state);
+}
+
+bool RenodeAgent::restoreResetSnapshot()
+{
+    if(resetSnapshot.empty())
+        return false;
+
+    StateReader state(resetSnapshot.data(), resetSnapshot.size());
+    for(auto& region : snapshotRegions)
+        state.read(region.data, region.size);
+    for(auto& b : targetInterfaces)
+        b->loadState(state);
+    for(auto& b : initatorInterfaces)
+        b->loadState(state);
+    return true;
+}
+
+void RenodeAgent::setModelStateHandlers(std::function<void(StateWriter&)> save, std::function<void(StateReader&)> load)
+{
+    saveModelState = save;
+    loadModelState = load;
+}
+
+void RenodeAgent::serialize(StateWriter& state)
+{
+    state.write<uint32_t>(AGENT_STATE_MAGIC);
+    state.write<uint32_t>(AGENT_STATE_VERSION);
+    state.write<uint64_t>(targetInterfaces.size());
+    state.write<uint64_t>(initatorInterfaces.size());
+    state.write<uint64_t>(snapshotRegions.size());
+    state.write(quantumCycles);
+    interrupts.serialize(state);
+    for(auto& b : targetInterfaces)
+        b->saveState(state);
+    for(auto& b : initatorInterfaces)
+        b->saveState(state);
+    for(auto& region : snapshotRegions) {
+        state.write<uint64_t>(region.size);
+        state.write(region.data, region.size);
+    }
+    state.write<uint8_t>(saveModelState ? 1 : 0);
+    if(saveModelState)
+        saveModelState(state);
+}
+
+void RenodeAgent::deserialize(StateReader& state)
+{
+    uint32_t magic, version;
+    state.read(magic);
+    state.read(version);
+    if(magic != AGENT_STATE_MAGIC || version != AGENT_STATE_VERSION) {
+        throw "Incompatible state";
+    }
+
+    uint64_t targets, initiators, regions;
+    state.read(targets);
+    state.read(initiators);
+    state.read(regions);
+    if(targets != targetInterfaces.size() || initiators != initatorInterfaces.size() || regions != snapshotRegions.size()) {
+        throw "The state was saved by an agent with a different configuration";
+    }
+
+    state.read(quantumCycles);
+    interrupts.deserialize(state);
+    for(auto& b : targetInterfaces)
+        b->loadState(state);
+    for(auto& b : initatorInterfaces)
+        b->loadState(state);
+    for(auto& region : snapshotRegions) {
+        uint64_t size;
+        state.read(size);
+        if(size != region.size) {
+            throw "The state was saved by an agent with a different configuration";
+        }
+        state.read(region.data, region.size);
+    }
+
+    uint8_t hasModelState;
+    state.read(hasModelState);
+    if(hasModelState != (loadModelState ? 1 : 0)) {
+        throw "The state was saved by an agent with a different configuration";
+    }
+    if(loadModelState)
+        loadModelState(state);
+
+    // Renode restores its memory together with the agent
+    invalidateCache(0, UINT64_MAX);
+    timestampedCycle = UINT64_MAX;
+}
+
+void RenodeAgent::sendState()
+{
+    std::vector<uint8_t> data;
+    try {
+        if(snapshotRegions.empty() && !saveModelState)
+            log(LOG_LEVEL_WARNING, "The state of the model isn't registered, only the state of the agent is saved");
+        StateWriter state(data);
+        serialize(state);
+    }
+    catch(const char* msg) {
+        log(LOG_LEVEL_ERROR, msg);
+        communicationChannel->sendMain(Protocol(error, 0, 0));
+        return;
+    }
+    communicationChannel->sendMain(Protocol(saveState, 0, data.size()));
+    sendBlock(true, data.data(), data.size());
+}
+
+void RenodeAgent::receiveState(uint64_t size)
+{
+    std::vector<uint8_t> data(size);
+    std::vector<uint8_t> backup;
+    try {
+        receiveBlock(data.data(), size);
+        // A state rejected halfway through mustn't leave the agent partially restored
+        StateWriter current(backup);
+        serialize(current);
+        StateReader state(data.data(), data.size());
+        deserialize(state);
+        if(!state.atEnd()) {
+            throw "Malformed state";
+        }
+    }
+    catch(const char* msg) {
+        log(LOG_LEVEL_ERROR, msg);
+        if(!backup.empty()) {
+            StateReader current(backup.data(), backup.size());
+            deserialize(current);
+        }
+        communicationChannel->sendMain(Protocol(error, 0, 0));
+        return;
+    }
+    communicationChannel->sendMain(Protocol(ok, 0, 0));
+}
+
+void RenodeAgent::handleCustomRequestType(Protocol* message)
+{
+    log(LOG_LEVEL_WARNING, "Unhandled request type: %d", message->actionId);
+}
+
+void RenodeAgent::log(int level, const char* fmt, ...)
+{
+    char s[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(s, 1024, fmt, ap);
+    auto lock = lockChannel();
+    communicationChannel->log(level, s);
+    va_end(ap);
+}
+
+void RenodeAgent::receive(Protocol* message)
+{
+    communicationChannel->receive(message);
+}
+
+void RenodeAgent::registerInterrupt(uint8_t *irq, uint8_t irq_addr)
+{
+    if (irq == nullptr) {
+        log(LOG_LEVEL_ERROR, "The irq address cannot be null");
+        communicationChannel->sendMain(Protocol(error, 0, 0));
+        return;
+    }
+
+    interrupts.add(irq, irq_addr);
+    updateCycleNotifications();
+    // The line may be set already, e.g. by the reset
+    interrupts.sample(quantumCycles);
+}
+
+void RenodeAgent::handleInterrupts(void)
+{
+    interrupts.sample(quantumCycles);
+}
+
+void RenodeAgent::reportInterrupts()
+{
+    auto lock = lockChannel();
+    interrupts.report([this](uint8_t number, uint8_t state, uint64_t cycle) {
+        sendEvent(Protocol(interrupt, number, state), cycle);
+        if(statistics)
+            statistics->count(interrupt);
+    });
+}
+
+void RenodeAgent::sendEvent(const Protocol message)
+{
+    // Edges sampled so far happened before this event, Renode has to get them first
+    if(interrupts.pending())
+        reportInterrupts();
+    sendEvent(message, quantumCycles);
+}
+
+void RenodeAgent::sendEvent(const Protocol message, uint64_t cycle)
+{
+    // The offset applies to all the following messages, so it's only sent when it changes
+    if(cycle != timestampedCycle && communicationChannel->usesExtension(cycleOffsets)) {
+        communicationChannel->sendSender(Protocol(cycleOffset, 0, cycle));
+        timestampedCycle = cycle;
+    }
+    communicationChannel->sendSender(message);
+    quantumActivity++;
+}
+
+uint64_t RenodeAgent::finishQuantum(uint64_t cycles)
+{
+    if(interrupts.pending())
+        reportInterrupts();
+    // Cycles simulated beyond the quantum belong to the next one
+    quantumCycles = quantumCycles > cycles ? quantumCycles - cycles : 0;
+    timestampedCycle = UINT64_MAX;
+    uint64_t activity = quantumActivity;
+    quantumActivity = 0;
+    return activity;
+}
+
+void RenodeAgent::simulate(int receiverPort, int senderPort, const char* address)
+{
+    SocketCommunicationChannel* channel = new SocketCommunicationChannel();
+    communicationChannel = channel;
+    channel->connect(receiverPort, senderPort, address);
+    Protocol request;
+    reset();
+
+    while(channel->isConnected()) {
+        receive(&request);
+        dispatchRequest(&request);
+    }
+}
+
+void RenodeAgent::simulate(const char* shmName)
+{
+#ifdef __linux__
+    ShmCommunicationChannel* channel = new ShmCommunicationChannel();
+    communicationChannel = channel;
+    channel->connect(shmName);
+    Protocol request;
+    reset();
+
+    while(channel->isConnected()) {
+        receive(&request);
+        dispatchRequest(&request);
+    }
+#else
+    throw "Shared memory communication is only supported on Linux";
+#endif
+}
+
+void RenodeAgent::simulate(int argc, char** argv)
+{
+    if(argc == 3 && strcmp(argv[1], "shm") == 0) {
+        simulate(argv[2]);
+    }
+    else if(argc == 3 || argc == 4) {
+        simulate(atoi(argv[1]), atoi(argv[2]), argc == 4 ? argv[3] : "127.0.0.1");
+    }
+    else {
+        throw "Usage: {receiverPort} {senderPort} [{address}] or shm {segment name}";
+    }
+}
+
+void RenodeAgent::simulate(LoopbackCommunicationChannel* channel)
+{
+    communicationChannel = channel;
+    Protocol request;
+    reset();
+
+    while(channel->isConnected()) {
+        receive(&request);
+        dispatchRequest(&request);
+    }
+}
+
+void RenodeAgent::handleRequest(Protocol* request)
+{
+    switch(request->actionId) {
+        case invalidAction:
+            break;
+        case tickClock:
+        {
+            long ticks = request->value - firstInterface->tickCounter;
+            if(ticks < 0) {
+                firstInterface->tickCounter -= request->value;
+            }
+            else {
+                tick(false, ticks);
+            }
+            firstInterface->tickCounter = 0;
+            uint64_t activity = finishQuantum(request->value);
+            communicationChannel->sendSender(Protocol(tickClock, activity, 0));
+        }
+            break;
+        case writeRequestByte:
+            writeToBus(1, request->addr, request->value);
+            break;
+        case writeRequestWord:
+            writeToBus(2, request->addr, request->value);
+            break;
+        case writeRequest: // due to historical reasons, writeRequest defaults to 32bits
+        case writeRequestDoubleWord:
+            writeToBus(4, request->addr, request->value);
+            break;
+        case writeRequestQuadWord:
+            writeToBus(8, request->addr, request->value);
+            break;
+        case readRequestByte:
+            readFromBus(1, request->addr);
+            break;
+        case readRequestWord:
+            readFromBus(2, request->addr);
+            break;
+        case readRequest: // due to historical reasons, writeRequest defaults to 32bits
+        case readRequestDoubleWord:
+            readFromBus(4, request->addr);
+            break;
+        case readRequestQuadWord:
+            readFromBus(8, request->addr);
+            break;
+        case writeRequestBlock:
+            writeBlockToBus(request->addr, request->value);
+            break;
+        case readRequestBlock:
+            readBlockFromBus(request->addr, request->value);
+            break;
+        case registerCacheableRegion:
+            addCacheableRegion(request->addr, request->value);
+            break;
+        case invalidateCachedRange:
+            invalidateCache(request->addr, request->value);
+            break;
+        case registerSharedMemory:
+            mapSharedMemoryFromRenode(request->addr, request->value);
+            break;
+        case enableStatistics:
+            setStatisticsEnabled(request->value != 0);
+            break;
+        case getStatistics:
+            logStatistics();
+            break;
+        case saveState:
+            sendState();
+            break;
+        case loadState:
+            receiveState(request->value);
+            break;
+        case resetPeripheral:
+            // Renode may reload its memory on reset
+            invalidateCache(0, UINT64_MAX);
+            reset();
+            break;
+        case disconnect:
+            if(statistics)
+                logStatistics();
+            communicationChannel->disconnect();
+            break;
+        default:
+            handleCustomRequestType(request);
+            break;
+    }
+}
+
+void RenodeAgent::dispatchRequest(Protocol* request)
+{
+    if(!statistics) {
+        handleRequest(request);
+    }
+    else {
+        int action = request->actionId;
+        uint64_t started = AgentStatistics::now();
+        handleRequest(request);
+        // The statistics may have been disabled by the request
+        if(statistics)
+            statistics->record(action, AgentStatistics::now() - started);
+    }
+    // Bus accesses may change the interrupt lines too
+    if(interrupts.pending())
+        reportInterrupts();
+}
+
+void RenodeAgent::setStatisticsEnabled(bool enabled)
+{
+    statistics.reset(enabled ? new AgentStatistics() : nullptr);
+}
+
+void RenodeAgent::logStatistics()
+{
+    if(!statistics) {
+        log(LOG_LEVEL_WARNING, "Statistics are disabled");
+        return;
+    }
+    statistics->report(this);
+}
+
+//=================================================
+// InterruptSampler
+//=================================================
+
+void InterruptSampler::add(uint8_t* line, uint8_t number)
+{
+    if(lines.size() % 64 == 0) {
+        sampled.push_back(0);
+        reported.push_back(0);
+        edges.push_back(0);
+    }
+    lines.push_back(line);
+    numbers.push_back(number);
+    firstEdge.push_back(0);
+    lastEdge.push_back(0);
+    // Up to two edges of every line are reported, the buffer mustn't grow while reporting
+    changes.reserve(2 * lines.size());
+}
+
+void InterruptSampler::sample(uint64_t cycle)
+{
+    for(size_t word = 0; word < sampled.size(); word++) {
+        size_t first = word * 64;
+        size_t count = std::min<size_t>(64, lines.size() - first);
+        uint64_t state = 0;
+        for(size_t i = 0; i < count; i++)
+            state |= (uint64_t)(*lines[first + i] != 0) << i;
+
+        uint64_t changes = state ^ sampled[word];
+        if(changes == 0)
+            continue;
+        sampled[word] = state;
+        uint64_t firstChanges = changes & ~edges[word];
+        edges[word] |= changes;
+        changed = true;
+        for(size_t i = 0; changes != 0; i++, changes >>= 1, firstChanges >>= 1) {
+            if(changes & 1) {
+                lastEdge[first + i] = cycle;
+                if(firstChanges & 1)
+                    firstEdge[first + i] = cycle;
+            }
+        }
+    }
+}
+
+void InterruptSampler::report(const std::function<void(uint8_t number, uint8_t state, uint64_t cycle)>& emit)
+{
+    changes.clear();
+    for(size_t word = 0; word < sampled.size(); word++) {
+        uint64_t lineEdges = edges[word];
+        for(size_t i = 0; lineEdges != 0; i++, lineEdges >>= 1) {
+            if(!(lineEdges & 1))
+                continue;
+            uint8_t state = (sampled[word] >> i) & 1;
+            if(state == ((reported[word] >> i) & 1))
+                changes.push_back({firstEdge[word * 64 + i], changes.size(), numbers[word * 64 + i], (uint8_t)!state});
+            changes.push_back({lastEdge[word * 64 + i], changes.size(), numbers[word * 64 + i], state});
+        }
+        reported[word] = sampled[word];
+        edges[word] = 0;
+    }
+    changed = false;
+
+    // In the order of the edges, the second edge of a pulse after the first one even in the same cycle
+    std::sort(changes.begin(), changes.end(), [](const Change& a, const Change& b) {
+        return a.cycle < b.cycle || (a.cycle == b.cycle && a.index < b.index);
+    });
+    for(auto& change : changes)
+        emit(change.number, change.state, change.cycle);
+}
+
+void InterruptSampler::serialize(StateWriter& state) const
+{
+    state.write<uint64_t>(lines.size());
+    state.write(sampled.data(), sampled.size() * sizeof(uint64_t));
+    state.write(reported.data(), reported.size() * sizeof(uint64_t));
+    state.write(edges.data(), edges.size() * sizeof(uint64_t));
+    state.write(firstEdge.data(), firstEdge.size() * sizeof(uint64_t));
+    state.write(lastEdge.data(), lastEdge.size() * sizeof(uint64_t));
+    state.write(changed);
+}
+
+void InterruptSampler::deserialize(StateReader& state)
+{
+    uint64_t count;
+    state.read(count);
+    if(count != lines.size()) {
+        throw "The state was saved with a different number of interrupts";
+    }
+    state.read(sampled.data(), sampled.size() * sizeof(uint64_t));
+    state.read(reported.data(), reported.size() * sizeof(uint64_t));
+    state.read(edges.data(), edges.size() * sizeof(uint64_t));
+    state.read(firstEdge.data(), firstEdge.size() * sizeof(uint64_t));
+    state.read(lastEdge.data(), lastEdge.size() * sizeof(uint64_t));
+    state.read(changed);
+}
+
+//=================================================
+// AgentStatistics
+//=================================================
+
+static const char* actionName(int action)
+{
+    switch(action) {
+        case invalidAction: return "invalidAction";
+        case tickClock: return "tickClock";
+        case writeRequest: return "writeRequest";
+        case readRequest: return "readRequest";
+        case resetPeripheral: return "resetPeripheral";
+        case interrupt: return "interrupt";
+        case disconnect: return "disconnect";
+        case pushDoubleWord: return "pushDoubleWord";
+        case getDoubleWord: return "getDoubleWord";
+        case pushWord: return "pushWord";
+        case getWord: return "getWord";
+        case pushByte: return "pushByte";
+        case getByte: return "getByte";
+        case registerGet: return "registerGet";
+        case registerSet: return "registerSet";
+        case singleStepMode: return "singleStepMode";
+        case readRequestByte: return "readRequestByte";
+        case readRequestWord: return "readRequestWord";
+        case readRequestDoubleWord: return "readRequestDoubleWord";
+        case readRequestQuadWord: return "readRequestQuadWord";
+        case writeRequestByte: return "writeRequestByte";
+        case writeRequestWord: return "writeRequestWord";
+        case writeRequestDoubleWord: return "writeRequestDoubleWord";
+        case writeRequestQuadWord: return "writeRequestQuadWord";
+        case writeRequestBlock: return "writeRequestBlock";
+        case readRequestBlock: return "readRequestBlock";
+        case getBlock: return "getBlock";
+        case pushBlock: return "pushBlock";
+        case registerCacheableRegion: return "registerCacheableRegion";
+        case invalidateCachedRange: return "invalidateCachedRange";
+        case registerSharedMemory: return "registerSharedMemory";
+        case pushDoubleWordMasked: return "pushDoubleWordMasked";
+        case enableStatistics: return "enableStatistics";
+        case getStatistics: return "getStatistics";
+        case saveState: return "saveState";
+        case loadState: return "loadState";
+        case step: return "step";
+        default: return nullptr;
+    }
+}
+
+AgentStatistics::AgentStatistics() : cycles(0), skippedCycles(0), evaluations(0), tickTime(0), started(now())
+{
+}
+
+uint64_t AgentStatistics::now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AgentStatistics::ActionStatistics& AgentStatistics::at(int action)
+{
+    // Custom actions out of range share the last entry
+    return perAction[action >= 0 && action < actions ? action : actions - 1];
+}
+
+void AgentStatistics::record(int action, uint64_t nanoseconds)
+{
+    ActionStatistics& entry = at(action);
+    if(!entry.latency)
+        entry.latency.reset(new Histogram());
+    entry.count++;
+    entry.latency->record(nanoseconds);
+}
+
+void AgentStatistics::count(int action)
+{
+    at(action).count++;
+}
+
+void AgentStatistics::addCycles(uint64_t evaluated, uint64_t skipped, uint64_t evaluations, uint64_t nanoseconds)
+{
+    cycles += evaluated;
+    skippedCycles += skipped;
+    this->evaluations += evaluations;
+    tickTime += nanoseconds;
+    tickLatency.record(nanoseconds);
+}
+
+void AgentStatistics::report(RenodeAgent* agent)
+{
+    double elapsed = (now() - started) / 1e9;
+    double ticking = tickTime / 1e9;
+    agent->log(LOG_LEVEL_INFO, "Statistics gathered for %.3f s, %.3f s spent ticking", elapsed, ticking);
+    agent->log(LOG_LEVEL_INFO, "Cycles: %" PRIu64 " evaluated (%.0f/s), %" PRIu64 " skipped; evaluateModel calls: %" PRIu64 " (%.0f/s)",
+        cycles, ticking > 0 ? cycles / ticking : 0.0, skippedCycles, evaluations, ticking > 0 ? evaluations / ticking : 0.0);
+    report(agent, "tick", &tickLatency, tickLatency.samples);
+
+    for(int action = 0; action < actions; action++) {
+        const ActionStatistics& entry = perAction[action];
+        if(entry.count == 0)
+            continue;
+        char name[32] = "custom";
+        const char* known = actionName(action);
+        if(known == nullptr && action != actions - 1)
+            snprintf(name, sizeof(name), "action %d", action);
+        report(agent, known != nullptr ? known : name, entry.latency.get(), entry.count);
+    }
+}
+
+void AgentStatistics::report(RenodeAgent* agent, const char* name, const Histogram* latency, uint64_t count)
+{
+    if(latency == nullptr || latency->samples == 0) {
+        agent->log(LOG_LEVEL_INFO, "%-24s count: %" PRIu64, name, count);
+        return;
+    }
+    agent->log(LOG_LEVEL_INFO, "%-24s count: %" PRIu64 ", latency [ns] min: %" PRIu64 ", mean: %" PRIu64
+        ", p50: %" PRIu64 ", p90: %" PRIu64 ", p99: %" PRIu64 ", max: %" PRIu64 ", total: %.3f s",
+        name, count, latency->min, latency->total / latency->samples, latency->percentile(0.5),
+        latency->percentile(0.9), latency->percentile(0.99), latency->max, latency->total / 1e9);
+}
+
+int AgentStatistics::bucket(uint64_t value)
+{
+    if(value < subBuckets)
+        return value;
+    int msb = 0;
+    for(uint64_t v = value; v > 1; v >>= 1)
+        msb++;
+    // subBuckets == 8, so the 3 bits below the most significant one select the sub-bucket
+    return (msb - 2) * subBuckets + ((value >> (msb - 3)) & (subBuckets - 1));
+}
+
+uint64_t AgentStatistics::bucketValue(int index)
+{
+    if(index < subBuckets)
+        return index;
+    int msb = index / subBuckets + 2;
+    return (uint64_t)(subBuckets + index % subBuckets) << (msb - 3);
+}
+
+AgentStatistics::Histogram::Histogram() : samples(0), total(0), min(UINT64_MAX), max(0)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+void AgentStatistics::Histogram::record(uint64_t value)
+{
+    samples++;
+    total += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+    counts[bucket(value)]++;
+}
+
+uint64_t AgentStatistics::Histogram::percentile(double fraction) const
+{
+    uint64_t threshold = (uint64_t)(fraction * samples);
+    uint64_t seen = 0;
+    for(int i = 0; i < buckets; i++) {
+        seen += counts[i];
+        if(seen > threshold)
+            return std::min(std::max(bucketValue(i), min), max);
+    }
+    return max;
+}
+
+//=================================================
+// TickWorkerPool
+//=================================================
+
+TickWorkerPool::TickWorkerPool(unsigned threads, std::function<void(unsigned)> job)
+    : job(job), generation(0), pending(0), stopping(false), error(nullptr)
+{
+    for(unsigned i = 1; i < threads; i++)
+        workers.emplace_back(&TickWorkerPool::work, this, i);
+}
+
+TickWorkerPool::~TickWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    started.notify_all();
+    for(auto& worker : workers)
+        worker.join();
+}
+
+void TickWorkerPool::run()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = workers.size();
+        generation++;
+    }
+    started.notify_all();
+
+    const char* localError = nullptr;
+    try {
+        job(0);
+    }
+    catch(const char* msg) {
+        localError = msg;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+    if(localError == nullptr)
+        localError = error;
+    error = nullptr;
+    if(localError != nullptr)
+        throw localError;
+}
+
+void TickWorkerPool::work(unsigned index)
+{
+    uint64_t seen = 0;
+    while(true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            started.wait(lock, [&] { return stopping || generation != seen; });
+            if(stopping)
+                return;
+            seen = generation;
+        }
+
+        const char* localError = nullptr;
+        try {
+            job(index);
+        }
+        catch(const char* msg) {
+            localError = msg;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if(localError != nullptr)
+            error = localError;
+        if(--pending == 0)
+            finished.notify_one();
+    }
+}
+
+//=================================================
+// StreamCommunicationChannel
+//=================================================
+
+// Frames are flushed early if they grow beyond this size
+#define MAX_FRAME_SIZE 65536
+
+StreamCommunicationChannel::StreamCommunicationChannel()
+    : connected(false), extensions(0), receivedOffset(0)
+{
+    mainFrame.records = 0;
+    senderFrame.records = 0;
+}
+
+void StreamCommunicationChannel::sendMain(const Protocol message)
+{
+    if(extensions & batchedFrames) {
+        append(mainFrame, (const char*)&message, sizeof(struct Protocol), true);
+    }
+    else {
+        writeMain((const char*)&message, sizeof(struct Protocol));
+    }
+}
+
+void StreamCommunicationChannel::sendSender(const Protocol message)
+{
+    if(extensions & batchedFrames) {
+        append(senderFrame, (const char*)&message, sizeof(struct Protocol), true);
+    }
+    else {
+        writeSender((const char*)&message, sizeof(struct Protocol));
+    }
+}
+
+void StreamCommunicationChannel::log(int logLevel, const char* data)
+{
+    sendSender(Protocol(logMessage, strlen(data), logLevel));
+    if(extensions & batchedFrames) {
+        append(senderFrame, data, strlen(data), false);
+    }
+    else {
+        writeSender(data, strlen(data));
+    }
+}
+
+void StreamCommunicationChannel::receive(Protocol* message)
+{
+    if(receivedOffset < receivedFrame.size()) {
+        memcpy(message, receivedFrame.data() + receivedOffset, sizeof(Protocol));
+        receivedOffset += sizeof(Protocol);
+        return;
+    }
+
+    // Renode may be waiting for the buffered messages before it sends anything
+    flush();
+    message->actionId = invalidAction;
+    readMain((char *)message, sizeof(Protocol));
+
+    if(message->actionId == batch && connected) {
+        // Renode only batches records, a header announcing anything else means the stream is corrupted
+        if(message->addr == 0 || message->value != message->addr * sizeof(Protocol) || message->value > MAX_FRAME_SIZE) {
+            log(LOG_LEVEL_ERROR, "Malformed batch frame received, disconnecting");
+            flush();
+            connected = false;
+            message->actionId = invalidAction;
+            return;
+        }
+        // The frame buffer keeps its capacity, so it's allocated only when a larger frame arrives
+        receivedFrame.resize(message->value);
+        receivedOffset = receivedFrame.size();
+        readMain(receivedFrame.data(), receivedFrame.size());
+        if(!connected) {
+            message->actionId = invalidAction;
+            return;
+        }
+        receivedOffset = 0;
+        receive(message);
+    }
+}
+
+bool StreamCommunicationChannel::isConnected()
+{
+    return connected;
+}
+
+bool StreamCommunicationChannel::usesExtension(ProtocolExtension extension)
+{
+    return extensions & extension;
+}
+
+void StreamCommunicationChannel::disconnect()
+{
+    sendSender(Protocol(ok, 0, 0));
+    flush();
+    connected = false;
+}
+
+void StreamCommunicationChannel::flush()
+{
+    flush(mainFrame, true);
+    flush(senderFrame, false);
+}
+
+void StreamCommunicationChannel::handshakeValid()
+{
+    Protocol received;
+    connected = true;
+    receive(&received);
+    if(received.actionId == handshake) {
+        uint64_t accepted = received.value & (AGENT_EXTENSIONS);
+        sendMain(Protocol(handshake, 0, accepted));
+        extensions = accepted;
+    }
+    else {
+        connected = false;
+    }
+}
+
+void StreamCommunicationChannel::append(Frame& frame, const char* data, size_t size, bool isRecord)
+{
+    // Payloads (e.g. log strings) always stay in the same frame as their record
+    if(isRecord && frame.buffer.size() >= MAX_FRAME_SIZE) {
+        flush(frame, &frame == &mainFrame);
+    }
+    if(frame.buffer.empty()) {
+        // Reserve space for the frame header, so the whole frame goes out in one write
+        frame.buffer.resize(sizeof(Protocol));
+    }
+    frame.buffer.insert(frame.buffer.end(), data, data + size);
+    if(isRecord) {
+        frame.records++;
+    }
+}
+
+void StreamCommunicationChannel::flush(Frame& frame, bool isMain)
+{
+    if(frame.records == 0) {
+        return;
+    }
+
+    Protocol header(batch, frame.records, frame.buffer.size() - sizeof(Protocol));
+    memcpy(frame.buffer.data(), &header, sizeof(Protocol));
+    if(isMain) {
+        writeMain(frame.buffer.data(), frame.buffer.size());
+    }
+    else {
+        writeSender(frame.buffer.data(), frame.buffer.size());
+    }
+    frame.buffer.clear();
+    frame.records = 0;
+}
+
+//=================================================
+// SocketCommunicationChannel
+//=================================================
+
+SocketCommunicationChannel::SocketCommunicationChannel()
+{
+    ASocket::SettingsFlag dontLog = ASocket::NO_FLAGS;
+    mainSocket.reset(new CTCPClient(NULL, dontLog));
+    senderSocket.reset(new CTCPClient(NULL, dontLog));
+}
+
+void SocketCommunicationChannel::writeMain(const char* data, size_t size)
+{
+    if(!mainSocket->Send(data, size)) {
+        connected = false;
+    }
+}
+
+void SocketCommunicationChannel::writeSender(const char* data, size_t size)
+{
+    if(!senderSocket->Send(data, size)) {
+        connected = false;
+    }
+}
+
+void SocketCommunicationChannel::readMain(char* data, size_t size)
+{
+    if(mainSocket->Receive(data, size) <= 0) {
+        connected = false;
+    }
+}
+
+void SocketCommunicationChannel::connect(int receiverPort, int senderPort, const char* address)
+{
+    mainSocket->Connect(address, std::to_string(receiverPort));
+    senderSocket->Connect(address, std::to_string(senderPort));
+    handshakeValid();
+}
+
+#ifdef __linux__
+//=================================================
+// ShmCommunicationChannel
+//=================================================
+
+// Number of busy-wait iterations before going to sleep on the futex.
+// Renode usually answers within microseconds, so it's cheaper to spin,
+// unless there is only one core and spinning just delays the other side.
+#define SHM_SPIN_COUNT 4096
+// Sleeping is time-limited to notice the other side closing the segment.
+#define SHM_WAIT_TIMEOUT_NS 1000000
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit integer");
+
+static inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+ShmCommunicationChannel::ShmCommunicationChannel()
+    : header(nullptr), segmentSize(0)
+{
+    spinCount = std::thread::hardware_concurrency() > 1 ? SHM_SPIN_COUNT : 0;
+}
+
+ShmCommunicationChannel::~ShmCommunicationChannel()
+{
+    if(header != nullptr) {
+        munmap(header, segmentSize);
+    }
+}
+
+void ShmCommunicationChannel::writeMain(const char* data, size_t size)
+{
+    write(header->responses, data, size);
+}
+
+void ShmCommunicationChannel::writeSender(const char* data, size_t size)
+{
+    write(header->sender, data, size);
+}
+
+void ShmCommunicationChannel::readMain(char* data, size_t size)
+{
+    read(header->requests, data, size);
+}
+
+void ShmCommunicationChannel::disconnect()
+{
+    StreamCommunicationChannel::disconnect();
+    header->closed = 1;
+    notify(header->responses);
+    notify(header->sender);
+}
+
+void ShmCommunicationChannel::connect(const char* name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if(fd < 0) {
+        throw "Unable to open the shared memory segment";
+    }
+
+    struct stat info;
+    if(fstat(fd, &info) < 0 || (size_t)info.st_size < sizeof(ShmSegmentHeader)) {
+        close(fd);
+        throw "Invalid shared memory segment";
+    }
+    segmentSize = info.st_size;
+
+    void* mapping = mmap(nullptr, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED) {
+        throw "Unable to map the shared memory segment";
+    }
+    header = (ShmSegmentHeader*)mapping;
+
+    if(header->magic != SHM_CHANNEL_MAGIC || header->version != SHM_CHANNEL_VERSION) {
+        throw "Unsupported shared memory segment version";
+    }
+    for(ShmRing* ring : { &header->requests, &header->responses, &header->sender }) {
+        if(ring->size == 0 || (ring->size & (ring->size - 1)) != 0 || (size_t)ring->offset + ring->size > segmentSize) {
+            throw "Invalid shared memory ring layout";
+        }
+    }
+
+    handshakeValid();
+}
+
+void ShmCommunicationChannel::write(ShmRing& ring, const char* data, size_t size)
+{
+    char* buffer = (char*)header + ring.offset;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    while(size > 0 && connected) {
+        uint32_t sequence = ring.sequence.load();
+        uint64_t space = ring.size - (head - ring.tail.load(std::memory_order_acquire));
+        if(space == 0) {
+            if(header->closed.load()) {
+                connected = false;
+                break;
+            }
+            wait(ring, sequence);
+            continue;
+        }
+
+        size_t position = head & (ring.size - 1);
+        size_t chunk = std::min<size_t>({ size, space, ring.size - position });
+        memcpy(buffer + position, data, chunk);
+        data += chunk;
+        size -= chunk;
+        head += chunk;
+        ring.head.store(head, std::memory_order_release);
+        notify(ring);
+    }
+}
+
+void ShmCommunicationChannel::read(ShmRing& ring, char* data, size_t size)
+{
+    const char* buffer = (const char*)header + ring.offset;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+
+    while(size > 0 && connected) {
+        uint32_t sequence = ring.sequence.load();
+        uint64_t available = ring.head.load(std::memory_order_acquire) - tail;
+        if(available == 0) {
+            if(header->closed.load()) {
+                connected = false;
+                break;
+            }
+            wait(ring, sequence);
+            continue;
+        }
+
+        size_t position = tail & (ring.size - 1);
+        size_t chunk = std::min<size_t>({ size, available, ring.size - position });
+        memcpy(data, buffer + position, chunk);
+        data += chunk;
+        size -= chunk;
+        tail += chunk;
+        ring.tail.store(tail, std::memory_order_release);
+        notify(ring);
+    }
+}
+
+void ShmCommunicationChannel::wait(ShmRing& ring, uint32_t sequence)
+{
+    for(int i = 0; i < spinCount; i++) {
+        if(ring.sequence.load() != sequence) {
+            return;
+        }
+        cpuRelax();
+    }
+
+    struct timespec timeout = { 0, SHM_WAIT_TIMEOUT_NS };
+    ring.waiters++;
+    syscall(SYS_futex, (uint32_t*)&ring.sequence, FUTEX_WAIT, sequence, &timeout, nullptr, 0);
+    ring.waiters--;
+}
+
+void ShmCommunicationChannel::notify(ShmRing& ring)
+{
+    ring.sequence++;
+    if(ring.waiters.load() > 0) {
+        syscall(SYS_futex, (uint32_t*)&ring.sequence, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+}
+#endif
+
+//=================================================
+// NativeCommunicationChannel
+//=================================================
+
+extern void handleMainMessage(void* ptr);
+extern void handleSenderMessage(void* ptr);
+extern void receive(void* ptr);
+
+EXTERNAL_AS(action_intptr, HandleMainMessage, handleMainMessage);
+EXTERNAL_AS(action_intptr, HandleSenderMessage, handleSenderMessage);
+EXTERNAL_AS(action_intptr, Receive, receive);
+
+// Renode copies the message before the handler returns,
+// so it's safe to pass pointers to the local copies.
+
+void NativeCommunicationChannel::sendMain(const Protocol message)
+{
+    handleMainMessage((void*)&message);
+}
+
+void NativeCommunicationChannel::sendSender(const Protocol message)
+{
+    handleSenderMessage((void*)&message);
+}
+
+void NativeCommunicationChannel::log(int logLevel, const char* data)
+{
+    Protocol text(logMessage, strlen(data) + 1, (uint64_t)data);
+    Protocol level(logMessage, 0, logLevel);
+    handleSenderMessage(&text);
+    handleSenderMessage(&level);
+}
+
+void NativeCommunicationChannel::receive(Protocol* message)
+{
+    ::receive(message);
+}
+
+//=================================================
+// LoopbackCommunicationChannel
+//=================================================
+
+LoopbackCommunicationChannel::LoopbackCommunicationChannel(size_t memorySize)
+    : memory(memorySize), messages(0), blockAddress(0), blockSize(0), blockOffset(0), connected(true)
+{
+}
+
+void LoopbackCommunicationChannel::sendMain(const Protocol message)
+{
+    messages++;
+    responses.push_back(message);
+}
+
+void LoopbackCommunicationChannel::sendSender(const Protocol message)
+{
+    messages++;
+    switch(message.actionId) {
+        case getByte:
+        case getWord:
+        case getDoubleWord:
+        {
+            uint64_t value = 0;
+            read(message.addr, (uint8_t*)&value, message.actionId == getByte ? 1 : message.actionId == getWord ? 2 : 4);
+            replies.push_back(Protocol(writeRequest, 0, value));
+        }
+            break;
+        case getBlock:
+            for(uint64_t offset = 0; offset < message.value; offset += BLOCK_DATA_SIZE) {
+                uint64_t record[2] = {0, 0};
+                read(message.addr + offset, (uint8_t*)record, std::min<uint64_t>(BLOCK_DATA_SIZE, message.value - offset));
+                replies.push_back(Protocol(blockData, record[0], record[1]));
+            }
+            break;
+        case pushByte:
+            write(message.addr, (const uint8_t*)&message.value, 1);
+            break;
+        case pushWord:
+            write(message.addr, (const uint8_t*)&message.value, 2);
+            break;
+        case pushDoubleWord:
+            write(message.addr, (const uint8_t*)&message.value, 4);
+            break;
+        case pushDoubleWordMasked:
+            for(int i = 0; i < 4; i++) {
+                if(message.value & (1ULL << (PUSH_MASK_SHIFT + i)))
+                    write(message.addr + i, (const uint8_t*)&message.value + i, 1);
+            }
+            break;
+        case pushBlock:
+            blockAddress = message.addr;
+            blockSize = message.value;
+            blockOffset = 0;
+            break;
+        case blockData:
+            if(blockOffset < blockSize) {
+                uint64_t record[2] = {message.addr, message.value};
+                write(blockAddress + blockOffset, (const uint8_t*)record, std::min<uint64_t>(BLOCK_DATA_SIZE, blockSize - blockOffset));
+                blockOffset += BLOCK_DATA_SIZE;
+            }
+            break;
+        case interrupt:
+            interrupts[message.addr] = message.value;
+            break;
+        default:
+            notifications.push_back(message);
+            break;
+    }
+}
+
+void LoopbackCommunicationChannel::log(int /* logLevel */, const char* /* data */)
+{
+    messages++;
+}
+
+void LoopbackCommunicationChannel::receive(Protocol* message)
+{
+    // Renode answers the requests of the agent before it sends anything else
+    std::deque<Protocol>& queue = replies.empty() ? requests : replies;
+    if(queue.empty())
+        throw "Loopback channel has nothing to receive";
+    *message = queue.front();
+    queue.pop_front();
+}
+
+bool LoopbackCommunicationChannel::isConnected()
+{
+    return connected && !requests.empty();
+}
+
+void LoopbackCommunicationChannel::disconnect()
+{
+    connected = false;
+}
+
+void LoopbackCommunicationChannel::request(const Protocol message)
+{
+    requests.push_back(message);
+}
+
+void LoopbackCommunicationChannel::read(uint64_t addr, uint8_t* data, uint64_t size)
+{
+    for(uint64_t i = 0; i < size; i++)
+        data[i] = memory[(addr + i) % memory.size()];
+}
+
+void LoopbackCommunicationChannel::write(uint64_t addr, const uint8_t* data, uint64_t size)
+{
+    for(uint64_t i = 0; i < size; i++)
+        memory[(addr + i) % memory.size()] = data[i];
+}
+
+//=================================================
+// Functions exported to Renode
+//=================================================
+
+void initialize_native()
+{
+    RenodeAgent* agent = Init();
+    agent->communicationChannel = new NativeCommunicationChannel();
+
+    // Slots of disconnected agents are reused
+    auto slot = std::find(nativeAgents.begin(), nativeAgents.end(), nullptr);
+    if(slot == nativeAgents.end())
+        slot = nativeAgents.insert(slot, agent);
+    else
+        *slot = agent;
+    selectedAgent = agent;
+    agent->communicationChannel->sendMain(Protocol(selectInstance, 0, slot - nativeAgents.begin()));
+}
+
+void handle_request(Protocol* request)
+{
+    if(request->actionId == selectInstance) {
+        if(request->value < nativeAgents.size() && nativeAgents[request->value] != nullptr)
+            selectedAgent = nativeAgents[request->value];
+        return;
+    }
+    // Nothing is selected after a disconnect until Renode selects another instance
+    if(selectedAgent == nullptr)
+        return;
+    selectedAgent->dispatchRequest(request);
+    if(request->actionId == disconnect) {
+        std::replace(nativeAgents.begin(), nativeAgents.end(), selectedAgent, (RenodeAgent*)nullptr);
+        delete selectedAgent->communicationChannel;
+        delete selectedAgent;
+        selectedAgent = nullptr;
+    }
 }
 
 void reset_peripheral()
 {
-    renodeAgent->reset();
+    if(selectedAgent != nullptr)
+        selectedAgent->reset();
 }
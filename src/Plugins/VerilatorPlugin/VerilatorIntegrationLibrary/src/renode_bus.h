@@ -7,15 +7,46 @@
 #ifndef RENODE_BUS_H
 #define RENODE_BUS_H
 #include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "buses/bus.h"
 #include "../libs/socket-cpp/Socket/TCPClient.h"
 #include "renode.h"
 
+// Protocol extensions accepted by the agent if Renode supports them. Cycle offsets cost a message
+// per timestamped event, so they're left out unless the model is built with them.
+#ifndef AGENT_EXTENSIONS
+#define AGENT_EXTENSIONS (batchedFrames | postedWrites | activityReports)
+#endif
+
+#ifndef AGENT_CACHE_LINE_SIZE
+#define AGENT_CACHE_LINE_SIZE 64
+#endif
+
+// Statistics are gathered from the start if set to 1, otherwise Renode has to enable them
+#ifndef AGENT_STATISTICS
+#define AGENT_STATISTICS 0
+#endif
+
 class RenodeAgent;
+class LoopbackCommunicationChannel;
 struct Protocol;
 
 extern RenodeAgent* Init(void); //definition has to be provided in sim_main.cpp of verilated peripheral
 
+// A library loaded by Renode can host several peripherals: initialize_native creates
+// a new agent with Init() every time it's called (so Init() mustn't reuse the model),
+// selects it and responds with selectInstance carrying its instance number. Renode
+// switches between the agents with selectInstance and the other requests go to the
+// selected agent. Disconnect deletes the agent and its number can be given to a new one.
+
 extern "C"
 {
   void initialize_native();
@@ -26,10 +57,125 @@ extern "C"
 class CommunicationChannel
 {
 public:
+  virtual ~CommunicationChannel() {}
   virtual void sendMain(const Protocol message) = 0;
   virtual void sendSender(const Protocol message) = 0;
   virtual void log(int logLevel, const char* data) = 0;
-  virtual Protocol* receive() = 0;
+  virtual void receive(Protocol* message) = 0;
+  virtual bool isConnected() { return true; }
+  virtual bool usesExtension(ProtocolExtension /* extension */) { return false; }
+  virtual void disconnect() {}
+  virtual void flush() {}
+};
+
+// Runs `job(index)` for every index in [0, threads) and returns when all of them are done.
+// Index 0 runs on the calling thread, the rest on persistent worker threads.
+class TickWorkerPool
+{
+public:
+  TickWorkerPool(unsigned threads, std::function<void(unsigned)> job);
+  ~TickWorkerPool();
+  void run();
+
+private:
+  void work(unsigned index);
+
+  std::function<void(unsigned)> job;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable started;
+  std::condition_variable finished;
+  uint64_t generation;
+  unsigned pending;
+  bool stopping;
+  const char* error;
+};
+
+// Counters and latency histograms gathered by the agent, see RenodeAgent::setStatisticsEnabled.
+// Histograms are log-linear (every power of two split into 8 linear sub-buckets, as in HDR
+// histograms), so percentiles are reported with a relative error below 12.5%.
+class AgentStatistics
+{
+public:
+  AgentStatistics();
+  static uint64_t now();
+  void record(int action, uint64_t nanoseconds);
+  void count(int action);
+  void addCycles(uint64_t evaluated, uint64_t skipped, uint64_t evaluations, uint64_t nanoseconds);
+  void report(RenodeAgent* agent);
+
+private:
+  static const int subBuckets = 8;
+  static const int buckets = 64 * subBuckets;
+  static const int actions = 128;
+
+  struct Histogram
+  {
+    Histogram();
+    void record(uint64_t value);
+    uint64_t percentile(double fraction) const;
+
+    uint64_t samples;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t counts[buckets];
+  };
+
+  struct ActionStatistics
+  {
+    uint64_t count = 0;
+    std::unique_ptr<Histogram> latency;
+  };
+
+  static int bucket(uint64_t value);
+  static uint64_t bucketValue(int index);
+  ActionStatistics& at(int action);
+  void report(RenodeAgent* agent, const char* name, const Histogram* latency, uint64_t count);
+
+  ActionStatistics perAction[actions];
+  Histogram tickLatency;
+  uint64_t cycles;
+  uint64_t skippedCycles;
+  uint64_t evaluations;
+  uint64_t tickTime;
+  uint64_t started;
+};
+
+// Interrupt lines registered with the agent, sampled into a bitmap (one bit per line) which is
+// compared with the previous sample 64 lines at a time. Edges are coalesced until reported:
+// a line is reported with its final state and the cycle of its last edge or, if it went back
+// to the state Renode knows of, as a pulse between the cycles of its first and last edge.
+// The changes of all the lines are reported in the order of their cycles.
+class InterruptSampler
+{
+public:
+  void add(uint8_t* line, uint8_t number);
+  void sample(uint64_t cycle);
+  void report(const std::function<void(uint8_t number, uint8_t state, uint64_t cycle)>& emit);
+  bool empty() const { return lines.empty(); }
+  bool pending() const { return changed; }
+  void serialize(StateWriter& state) const;
+  void deserialize(StateReader& state);
+
+private:
+  std::vector<uint8_t*> lines;
+  std::vector<uint8_t> numbers;
+  std::vector<uint64_t> sampled;
+  std::vector<uint64_t> reported;
+  std::vector<uint64_t> edges;
+  std::vector<uint64_t> firstEdge;
+  std::vector<uint64_t> lastEdge;
+  bool changed = false;
+
+  struct Change
+  {
+    uint64_t cycle;
+    size_t index;
+    uint8_t number;
+    uint8_t state;
+  };
+  std::vector<Change> changes;
 };
 
 class RenodeAgent
@@ -37,68 +183,318 @@ class RenodeAgent
 public:
   RenodeAgent(BaseInitiatorBus* bus);
   RenodeAgent(BaseTargetBus* bus);
+  // The buses are owned by the agent, the communication channel and the model aren't
+  virtual ~RenodeAgent();
   virtual void addBus(BaseInitiatorBus* bus);
   virtual void addBus(BaseTargetBus* bus);
   virtual void writeToBus(int width, uint64_t addr, uint64_t value);
   virtual void readFromBus(int width, uint64_t addr);
+  virtual void writeBlockToBus(uint64_t addr, uint64_t size);
+  virtual void readBlockFromBus(uint64_t addr, uint64_t size);
   virtual void pushByteToAgent(uint64_t addr, uint8_t value);
   virtual void pushWordToAgent(uint64_t addr, uint16_t value);
   virtual void pushDoubleWordToAgent(uint64_t addr, uint32_t value);
+  virtual void pushDoubleWordMaskedToAgent(uint64_t addr, uint32_t value, uint8_t mask);
+  virtual uint64_t requestByteFromAgent(uint64_t addr);
+  virtual uint64_t requestWordFromAgent(uint64_t addr);
   virtual uint64_t requestDoubleWordFromAgent(uint64_t addr);
   virtual void pushToAgent(uint64_t addr, uint64_t value);
   virtual uint64_t requestFromAgent(uint64_t addr);
+  virtual void pushBlockToAgent(uint64_t addr, const uint8_t* data, uint64_t size);
+  virtual void requestBlockFromAgent(uint64_t addr, uint8_t* data, uint64_t size);
   virtual void tick(bool countEnable, uint64_t steps);
   virtual void timeoutTick(uint8_t* signal, uint8_t expectedValue, int timeout = 2000);
   virtual void reset();
   virtual void handleCustomRequestType(Protocol* message);
   virtual void log(int level, const char* fmt, ...);
-  virtual struct Protocol* receive();
+  virtual void receive(Protocol* message);
+  // Interrupts: registered lines are sampled after every cycle of a bus (after every
+  // `lookahead` cycles when ticking in parallel) and their changes are reported at the end
+  // of the tickClock quantum or the request which caused them. handleInterrupts samples them
+  // immediately, it's only needed if the lines change outside of the buses' tick.
   virtual void registerInterrupt(uint8_t *irq, uint8_t irq_addr);
   virtual void handleInterrupts(void);
   virtual void simulate(int receiverPort, int senderPort, const char* address);
+  virtual void simulate(const char* shmName);
+  // Connects as requested by the arguments Renode starts the peripheral with: `{receiverPort}
+  // {senderPort} [{address}]` for the sockets or `shm {segment name}` for shared memory
+  virtual void simulate(int argc, char** argv);
+  virtual void simulate(LoopbackCommunicationChannel* channel);
   virtual void handleRequest(Protocol* request);
 
+  // Idle skipping: while all idle signals have their idle values and the idle
+  // predicate (if set) holds, the model can't change until the next external
+  // event, so the rest of the requested cycles is skipped without evaluating it.
+  // The state is checked every `idleCheckInterval` cycles.
+  virtual void setIdlePredicate(std::function<bool()> predicate);
+  virtual void addIdleSignal(uint8_t* signal, uint8_t idleValue);
+  virtual void setIdleCheckInterval(uint64_t cycles);
+
+  // Parallel tick: buses are distributed over `threads` threads which synchronize
+  // every `lookahead` cycles. Only valid if every bus drives a separate model
+  // partition (its own `evaluateModel` not sharing state with the other buses).
+  // Renode mustn't issue requests to the agent while a bus waits for its data.
+  // `threads` <= 1 restores serial ticking.
+  virtual void setParallelTick(unsigned threads, uint64_t lookahead = 1);
+
+  // Memory cache: reads from cacheable regions of Renode memory are served from
+  // a local shadow, filled with getBlock in lines of AGENT_CACHE_LINE_SIZE bytes.
+  // Writes go through to Renode and update the shadow. Renode sends invalidateCachedRange
+  // when anyone else writes to a cacheable region, before its next request.
+  virtual void addCacheableRegion(uint64_t addr, uint64_t size);
+  virtual void invalidateCache(uint64_t addr, uint64_t size);
+  // True if the range lies in a cacheable or shared region: it's plain memory, so it can be
+  // accessed in blocks and ahead of time, unlike peripherals relying on the access width.
+  bool isMemoryBacked(uint64_t addr, uint64_t size);
+
+  // Shared memory: `size` bytes of guest memory starting at `addr` are backed by
+  // the file `path` at `offset`, which is mapped into the agent's address space.
+  // Accesses to this range are plain loads and stores, no messages are sent.
+  virtual void mapSharedMemory(uint64_t addr, uint64_t size, const char* path, uint64_t offset = 0);
+
+  // Statistics: when enabled, the agent counts requests of every action and
+  // records their latencies, as well as the cycles simulated. The report is
+  // logged by logStatistics, on getStatistics and on disconnect. Latencies
+  // are inclusive, e.g. tickClock contains the bus requests made by the model.
+  virtual void setStatisticsEnabled(bool enabled);
+  virtual void logStatistics();
+
+  // Fast reset: once enabled, the state right after the next reset is captured (the state of
+  // the buses and the contents of the regions added with addSnapshotRegion) and the following
+  // resets restore it with memcpy instead of driving the reset signals. The regions have to
+  // hold the whole state of the model and mustn't point to memory allocated later, e.g. the
+  // root structure of a model without dynamic data types (`top->rootp`, `sizeof(*top->rootp)`).
+  virtual void setFastReset(bool enabled);
+  virtual void addSnapshotRegion(void* data, size_t size);
+
+  // State: serialize writes everything needed to resume the simulation later, i.e. the state
+  // of the agent, its buses and the model, into a binary blob which deserialize restores in an
+  // agent with the same configuration. Renode requests it with saveState and loadState.
+  // The model is saved with its snapshot regions and with the handlers set here, e.g.
+  // registerVerilatedModelState from verilated_state.h for models verilated with --savable.
+  virtual void serialize(StateWriter& state);
+  virtual void deserialize(StateReader& state);
+  virtual void setModelStateHandlers(std::function<void(StateWriter&)> save, std::function<void(StateReader&)> load);
+
   std::vector<std::unique_ptr<BaseTargetBus>> targetInterfaces;
   std::vector<std::unique_ptr<BaseInitiatorBus>> initatorInterfaces;
 
 protected:
-  struct Interrupt {
-    uint8_t* irq;
-    uint8_t prev_irq;
-    uint8_t irq_addr;
+  struct IdleSignal {
+    uint8_t* signal;
+    uint8_t idleValue;
+  };
+
+  struct SharedMemoryRegion {
+    uint64_t start;
+    uint64_t size;
+    uint8_t* data;
+    // Page-aligned mapping containing the region
+    void* mapping;
+    uint64_t mappingSize;
   };
 
-  std::vector<Interrupt> interrupts;
-  CommunicationChannel* communicationChannel;
+  struct SnapshotRegion {
+    void* data;
+    size_t size;
+  };
+
+  struct CacheableRegion {
+    uint64_t start;
+    uint64_t size;
+    std::unique_ptr<uint8_t[]> data;
+    std::vector<bool> validLines;
+  };
+
+  virtual void tickIdle(bool countEnable, uint64_t steps);
+  virtual void tickBuses(bool countEnable, uint64_t steps);
+  void updateCycleNotifications();
+  static void cycleTicked(RenodeAgent* agent);
+  virtual bool isIdle();
+  virtual void skipCycles(bool countEnable, uint64_t steps);
+  virtual void tickPartition(unsigned index);
+  std::unique_lock<std::recursive_mutex> lockChannel();
+  void receiveBlock(uint8_t* data, uint64_t size);
+  void sendBlock(bool mainChannel, const uint8_t* data, uint64_t size);
+  void writeCompleted(bool success, uint64_t addr);
+  void mapSharedMemoryFromRenode(uint64_t addr, uint64_t size);
+  uint64_t requestValue(int action, uint64_t addr, uint64_t size);
+  uint8_t* sharedMemoryPointer(uint64_t addr, uint64_t size);
+  CacheableRegion* findCacheableRegion(uint64_t addr, uint64_t size);
+  bool readCached(uint64_t addr, uint8_t* data, uint64_t size);
+  void writeCached(uint64_t addr, const uint8_t* data, uint64_t size);
+  void dispatchRequest(Protocol* request);
+  void reportInterrupts();
+  void sendEvent(const Protocol message);
+  void sendEvent(const Protocol message, uint64_t cycle);
+  uint64_t finishQuantum(uint64_t cycles);
+  bool restoreResetSnapshot();
+  void captureResetSnapshot();
+  void sendState();
+  void receiveState(uint64_t size);
+
+  InterruptSampler interrupts;
+  // Cycles simulated since the end of the last tickClock quantum
+  uint64_t quantumCycles = 0;
+  // quantumCycles at the end of the buses' current tick, outside of the ticks the cycles
+  // simulated by the accesses of Renode advance it without a limit
+  uint64_t tickEnd = UINT64_MAX;
+  // Offset sent with the last event in this quantum
+  uint64_t timestampedCycle = UINT64_MAX;
+  // Bus accesses from Renode and events sent to it in this quantum
+  uint64_t quantumActivity = 0;
+  CommunicationChannel* communicationChannel = nullptr;
   BaseBus* firstInterface;
 
+  std::function<bool()> idlePredicate;
+  std::vector<IdleSignal> idleSignals;
+  uint64_t idleCheckInterval = DEFAULT_IDLE_CHECK_INTERVAL;
+  uint64_t skippedCycles = 0;
+
+  std::unique_ptr<TickWorkerPool> tickPool;
+  std::recursive_mutex channelMutex;
+  unsigned tickThreads = 1;
+  uint64_t tickLookahead = 1;
+  bool partitionCountEnable;
+  uint64_t partitionSteps;
+
+  std::vector<uint8_t> blockBuffer;
+  std::vector<SharedMemoryRegion> sharedMemoryRegions;
+  std::vector<CacheableRegion> cacheableRegions;
+
+  std::unique_ptr<AgentStatistics> statistics;
+
+  bool fastReset = false;
+  std::vector<SnapshotRegion> snapshotRegions;
+  // Empty until captured
+  std::vector<uint8_t> resetSnapshot;
+
+  std::function<void(StateWriter&)> saveModelState;
+  std::function<void(StateReader&)> loadModelState;
+
 private:
   friend void ::handle_request(Protocol* request);
   friend void ::initialize_native(void);
   friend void ::reset_peripheral(void);
 };
 
-class SocketCommunicationChannel : public CommunicationChannel
+// Base for channels transferring Protocol messages over byte streams.
+// If Renode requests the `batchedFrames` extension during the handshake, messages
+// are buffered and sent as a single `batch` frame: Protocol(batch, count, size)
+// followed by `size` bytes of `count` records, framed the same way as without batching.
+// Pending messages are flushed whenever the agent is about to wait for Renode.
+// A received frame announcing anything but whole records, or more than MAX_FRAME_SIZE
+// bytes, drops the connection.
+class StreamCommunicationChannel : public CommunicationChannel
 {
 public:
-  SocketCommunicationChannel();
   void sendMain(const Protocol message) override;
   void sendSender(const Protocol message) override;
   void log(int logLevel, const char* data) override;
-  Protocol* receive() override;
+  void receive(Protocol* message) override;
+  bool isConnected() override;
+  bool usesExtension(ProtocolExtension extension) override;
+  void disconnect() override;
+  void flush() override;
 
-private:
+protected:
+  StreamCommunicationChannel();
   void handshakeValid();
+  virtual void writeMain(const char* data, size_t size) = 0;
+  virtual void writeSender(const char* data, size_t size) = 0;
+  virtual void readMain(char* data, size_t size) = 0;
+
+  bool connected;
+
+private:
+  struct Frame
+  {
+    std::vector<char> buffer;
+    uint64_t records;
+  };
+
+  void append(Frame& frame, const char* data, size_t size, bool isRecord);
+  void flush(Frame& frame, bool isMain);
+
+  uint64_t extensions;
+  Frame mainFrame;
+  Frame senderFrame;
+  std::vector<char> receivedFrame;
+  size_t receivedOffset;
+};
+
+class SocketCommunicationChannel : public StreamCommunicationChannel
+{
+public:
+  SocketCommunicationChannel();
+
+private:
   void connect(int receiverPort, int senderPort, const char* address);
+  void writeMain(const char* data, size_t size) override;
+  void writeSender(const char* data, size_t size) override;
+  void readMain(char* data, size_t size) override;
   
   std::unique_ptr<CTCPClient> mainSocket;
   std::unique_ptr<CTCPClient> senderSocket;
-  bool isConnected;
 
   friend void RenodeAgent::simulate(int receiverPort, int senderPort, const char* address);
-  friend void RenodeAgent::handleRequest(Protocol* request);
 };
 
+#ifdef __linux__
+// Layout of the shared-memory segment used by ShmCommunicationChannel.
+// It is created by Renode and must be in sync with its ShmVerilatorConnection.
+// Every ring is a single-producer single-consumer byte stream, so the
+// framing is exactly the same as on the TCP sockets.
+#define SHM_CHANNEL_MAGIC 0x52454E4F // "RENO"
+#define SHM_CHANNEL_VERSION 1
+
+struct ShmRing
+{
+  alignas(64) std::atomic<uint64_t> head;   // total bytes written, owned by the producer
+  alignas(64) std::atomic<uint64_t> tail;   // total bytes read, owned by the consumer
+  alignas(64) std::atomic<uint32_t> sequence; // futex word, bumped on every head/tail update
+  std::atomic<uint32_t> waiters;
+  uint32_t offset;                          // data offset from the beginning of the segment
+  uint32_t size;                            // data size in bytes, power of 2
+};
+
+struct ShmSegmentHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<uint32_t> closed;
+  ShmRing requests;  // Renode -> agent, main channel
+  ShmRing responses; // agent -> Renode, main channel
+  ShmRing sender;    // agent -> Renode, sender channel
+};
+
+class ShmCommunicationChannel : public StreamCommunicationChannel
+{
+public:
+  ShmCommunicationChannel();
+  ~ShmCommunicationChannel();
+  void disconnect() override;
+
+protected:
+  void connect(const char* name);
+
+private:
+  void writeMain(const char* data, size_t size) override;
+  void writeSender(const char* data, size_t size) override;
+  void readMain(char* data, size_t size) override;
+  void write(ShmRing& ring, const char* data, size_t size);
+  void read(ShmRing& ring, char* data, size_t size);
+  void wait(ShmRing& ring, uint32_t sequence);
+  void notify(ShmRing& ring);
+
+  ShmSegmentHeader* header;
+  size_t segmentSize;
+  int spinCount;
+
+  friend void RenodeAgent::simulate(const char* shmName);
+};
+#endif
+
 class NativeCommunicationChannel : public CommunicationChannel
 {
 public:
@@ -106,7 +502,44 @@ public:
   void sendMain(const Protocol message) override;
   void sendSender(const Protocol message) override;
   void log(int logLevel, const char* data) override;
-  Protocol* receive() override;
+  void receive(Protocol* message) override;
+};
+
+// In-process stand-in for Renode, e.g. for testing and benchmarking the agent without it.
+// Requests queued with `request` are received by the agent in order. The requests of the
+// agent are served from `memory` (mirrored over the whole address space) and its pushes
+// are written there, interrupts are recorded in `interrupts` by number, the other messages
+// go to `responses` (main channel) and `notifications` (sender channel). `messages` counts
+// everything sent by the agent, logs included. The channel stays connected while there
+// are requests to receive.
+class LoopbackCommunicationChannel : public CommunicationChannel
+{
+public:
+  LoopbackCommunicationChannel(size_t memorySize = 65536);
+  void sendMain(const Protocol message) override;
+  void sendSender(const Protocol message) override;
+  void log(int logLevel, const char* data) override;
+  void receive(Protocol* message) override;
+  bool isConnected() override;
+  void disconnect() override;
+  void request(const Protocol message);
+
+  std::vector<uint8_t> memory;
+  std::map<uint64_t, uint64_t> interrupts;
+  std::deque<Protocol> responses;
+  std::deque<Protocol> notifications;
+  uint64_t messages;
+
+private:
+  void read(uint64_t addr, uint8_t* data, uint64_t size);
+  void write(uint64_t addr, const uint8_t* data, uint64_t size);
+
+  std::deque<Protocol> requests;
+  std::deque<Protocol> replies;
+  uint64_t blockAddress;
+  uint64_t blockSize;
+  uint64_t blockOffset;
+  bool connected;
 };
 
 #endif
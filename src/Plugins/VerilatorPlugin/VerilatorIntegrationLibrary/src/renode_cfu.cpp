@@ -68,15 +68,20 @@ void RenodeAgent::log(int level, const char* fmt, ...)
 extern void handleSenderMessage(void* ptr);
 EXTERNAL_AS(action_intptr, HandleSenderMessage, handleSenderMessage);
 
+// Renode copies the message before the handler returns,
+// so it's safe to pass pointers to the local copies.
+
 void NativeCommunicationChannel::sendSender(const Protocol message)
 {
-    handleSenderMessage(new Protocol(message));
+    handleSenderMessage((void*)&message);
 }
 
 void NativeCommunicationChannel::log(int logLevel, const char* data)
 {
-    handleSenderMessage(new Protocol(logMessage, strlen(data) + 1, (uint64_t)data));
-    handleSenderMessage(new Protocol(logMessage, 0, logLevel));
+    Protocol text(logMessage, strlen(data) + 1, (uint64_t)data);
+    Protocol level(logMessage, 0, logLevel);
+    handleSenderMessage(&text);
+    handleSenderMessage(&level);
 }
 
 //=================================================
@@ -37,7 +37,7 @@ public:
   NativeCommunicationChannel() = default;
   void sendSender(const Protocol message);
   void log(int logLevel, const char* data);
-  Protocol* receive();
+  void receive(Protocol* message);
 };
 
 class RenodeAgent
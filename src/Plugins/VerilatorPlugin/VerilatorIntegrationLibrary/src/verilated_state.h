@@ -0,0 +1,123 @@
+//
+// Copyright (c) 2010-2022 Antmicro
+//
+// This file is licensed under the MIT License.
+// Full license text is available in 'licenses/MIT.txt'.
+//
+#ifndef VERILATED_STATE_H
+#define VERILATED_STATE_H
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "verilated_save.h"
+#include "renode_bus.h"
+
+// Saving the state of a verilated model together with the agent's (see RenodeAgent::serialize).
+// It isn't part of the library's sources, as it needs the Verilator runtime: include it in
+// sim_main.cpp of a model verilated with --savable and call registerVerilatedModelState.
+
+// VerilatedSave writing to memory instead of a file
+class VerilatedStateSerializer : public VerilatedSerialize
+{
+public:
+    VerilatedStateSerializer(std::vector<uint8_t>& data) : data(data)
+    {
+        m_isOpen = true;
+        header();
+    }
+
+    ~VerilatedStateSerializer() override
+    {
+        close();
+    }
+
+    void close() override
+    {
+        if(!isOpen())
+            return;
+        trailer();
+        flush();
+        m_isOpen = false;
+    }
+
+    void flush() override
+    {
+        data.insert(data.end(), m_bufp, m_cp);
+        m_cp = m_bufp;
+    }
+
+private:
+    std::vector<uint8_t>& data;
+};
+
+// VerilatedRestore reading from memory instead of a file
+class VerilatedStateDeserializer : public VerilatedDeserialize
+{
+public:
+    VerilatedStateDeserializer(const uint8_t* data, size_t size) : data(data), remaining(size)
+    {
+        m_isOpen = true;
+        m_cp = m_bufp;
+        m_endp = m_bufp;
+        fill();
+        header();
+    }
+
+    ~VerilatedStateDeserializer() override
+    {
+        close();
+    }
+
+    void close() override
+    {
+        if(!isOpen())
+            return;
+        trailer();
+        m_isOpen = false;
+    }
+
+    // Unread data is moved to the beginning of the buffer and the rest of it is filled,
+    // with zeros past the end of the data as in VerilatedRestore
+    void fill() override
+    {
+        size_t unread = m_endp - m_cp;
+        memmove(m_bufp, m_cp, unread);
+        m_cp = m_bufp;
+        m_endp = m_bufp + unread;
+
+        size_t space = bufferSize() - unread;
+        size_t size = std::min(space, remaining);
+        memcpy(m_endp, data, size);
+        memset(m_endp + size, 0, space - size);
+        m_endp += space;
+        data += size;
+        remaining -= size;
+    }
+
+private:
+    const uint8_t* data;
+    size_t remaining;
+};
+
+// The model is stored with its size, as the deserializer reads ahead
+template<typename Model>
+void registerVerilatedModelState(RenodeAgent* agent, Model* model)
+{
+    agent->setModelStateHandlers(
+        [model](StateWriter& state) {
+            std::vector<uint8_t> data;
+            {
+                VerilatedStateSerializer serializer(data);
+                serializer << *model;
+            }
+            state.write(data);
+        },
+        [model](StateReader& state) {
+            std::vector<uint8_t> data;
+            state.read(data);
+            VerilatedStateDeserializer deserializer(data.data(), data.size());
+            deserializer >> *model;
+        });
+}
+
+#endif